@@ -0,0 +1,317 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "gpu_memory.h"
+
+// Uploads buffers on a dedicated transfer queue so they never wait behind
+//  rendering. Data is staged in a persistently mapped ring and copies are
+//  batched into one command buffer until submit(), which signals a timeline
+//  semaphore with the batch's value, and the ring space a batch read is
+//  reused once the timeline reached it. When the transfer family differs
+//  from the graphics family the buffers are released at the end of the
+//  batch and acquired by recordAcquire() on the graphics queue. Not thread
+//  safe, everything runs on the thread driving the frames
+class AsyncUploader {
+public:
+  void init(VkDevice device, GpuAllocator& allocator, VkQueue queue, uint32_t transferFamily, uint32_t graphicsFamily,
+            VkDeviceSize stagingCapacity) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->queue = queue;
+    this->transferFamily = transferFamily;
+    this->graphicsFamily = graphicsFamily;
+    stagingSpace.init(stagingCapacity);
+
+    // Persistently mapped staging ring
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = stagingCapacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload staging buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, stagingBuffer, &memRequirements);
+    stagingAllocation = allocator.allocate(memRequirements,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, GpuResourceKind::Linear);
+    vkBindBufferMemory(device, stagingBuffer, stagingAllocation.memory, stagingAllocation.offset);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = transferFamily;
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload command pool!");
+    }
+
+    // Counts up by one for every submitted batch
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &timelineInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create upload timeline semaphore!");
+    }
+  }
+
+  void destroy() {
+    submit();
+    wait(lastSubmitted);
+    collect();
+
+    vkDestroySemaphore(device, timeline, nullptr);
+    vkDestroyCommandPool(device, commandPool, nullptr);
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingAllocation);
+  }
+
+  // Copies size bytes of data into dst at dstOffset once the current batch is submitted,
+  //  split into chunks when larger than the ring. dst is owned by the graphics
+  //  queue again once recordAcquire picked it up
+  void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    if (size == 0) {return;}
+
+    const char* bytes = static_cast<const char*>(data);
+    VkDeviceSize remaining = size;
+    VkDeviceSize chunkDstOffset = dstOffset;
+    while (remaining > 0) {
+      VkDeviceSize chunkSize = std::min(remaining, stagingSpace.size());
+      VkDeviceSize srcOffset = reserve(chunkSize, 4);
+      memcpy(static_cast<char*>(stagingAllocation.mapped) + srcOffset, bytes, static_cast<size_t>(chunkSize));
+
+      VkBufferCopy copyRegion{};
+      copyRegion.srcOffset = srcOffset;
+      copyRegion.dstOffset = chunkDstOffset;
+      copyRegion.size = chunkSize;
+      vkCmdCopyBuffer(recording.commandBuffer, stagingBuffer, dst, 1, &copyRegion);
+
+      bytes += chunkSize;
+      chunkDstOffset += chunkSize;
+      remaining -= chunkSize;
+    }
+
+    // Queue family ownership moves from the transfer to the graphics queue,
+    //  the release below and the acquire in recordAcquire use the same barrier
+    if (transferFamily != graphicsFamily) {
+      VkBufferMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = transferFamily;
+      barrier.dstQueueFamilyIndex = graphicsFamily;
+      barrier.buffer = dst;
+      barrier.offset = dstOffset;
+      barrier.size = size;
+      recording.ownershipBarriers.push_back(barrier);
+    }
+  }
+
+  // Submits the batched copies, returning the timeline value signaled once
+  //  they are done, or 0 if there was nothing to submit
+  uint64_t submit() {
+    if (!recordingActive) {
+      return 0;
+    }
+    recordingActive = false;
+
+    // Release the buffers, only the transfer writes matter on this side
+    std::vector<VkBufferMemoryBarrier> releaseBarriers = recording.ownershipBarriers;
+    for (VkBufferMemoryBarrier& barrier : releaseBarriers) {
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = 0;
+    }
+    if (!releaseBarriers.empty()) {
+      vkCmdPipelineBarrier(recording.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+          0, 0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), 0, nullptr);
+    }
+
+    if (vkEndCommandBuffer(recording.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record upload command buffer!");
+    }
+
+    recording.timelineValue = ++lastSubmitted;
+    recording.stagingEnd = stagingSpace.end();
+
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &recording.timelineValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineSubmitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &recording.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &timeline;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+      throw std::runtime_error("failed to submit upload command buffer!");
+    }
+
+    // Hand the acquires to the next graphics submission
+    pendingAcquires.insert(pendingAcquires.end(), recording.ownershipBarriers.begin(), recording.ownershipBarriers.end());
+    pendingAcquireValue = recording.timelineValue;
+
+    recording.ownershipBarriers.clear();
+    inFlight.push_back(std::move(recording));
+    recording = Batch{};
+
+    return lastSubmitted;
+  }
+
+  // Records the acquire of every buffer submitted since the last call into a
+  //  graphics command buffer. Returns the timeline value its submission has
+  //  to wait on, or 0 if nothing was uploaded since
+  uint64_t recordAcquire(VkCommandBuffer commandBuffer) {
+    collect();
+
+    // Waiting on a value that was already reached costs nothing, but keeps the
+    //  transfer writes ordered before the graphics reads
+    uint64_t waitValue = pendingAcquireValue;
+    pendingAcquireValue = 0;
+
+    if (!pendingAcquires.empty()) {
+      for (VkBufferMemoryBarrier& barrier : pendingAcquires) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+      }
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+          0, 0, nullptr, static_cast<uint32_t>(pendingAcquires.size()), pendingAcquires.data(), 0, nullptr);
+      pendingAcquires.clear();
+    }
+
+    return waitValue;
+  }
+
+  bool isComplete(uint64_t value) {
+    if (value > completedValue) {
+      vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+    }
+    return value <= completedValue;
+  }
+
+  void wait(uint64_t value) {
+    if (isComplete(value)) {
+      return;
+    }
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    completedValue = value;
+  }
+
+  VkSemaphore semaphore() const {return timeline;}
+
+private:
+  // Copies recorded into one command buffer and submitted together
+  struct Batch {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    std::vector<VkBufferMemoryBarrier> ownershipBarriers;
+    uint64_t timelineValue = 0;
+    VkDeviceSize stagingEnd = 0; // End of the ring space the batch reads, released once it is done
+  };
+
+  VkDevice device;
+  GpuAllocator* allocator;
+  VkQueue queue;
+  uint32_t transferFamily;
+  uint32_t graphicsFamily;
+
+  VkCommandPool commandPool;
+  VkSemaphore timeline;
+  VkBuffer stagingBuffer;
+  GpuAllocation stagingAllocation;
+  RingSpace stagingSpace; // Of stagingBuffer, reserved by uploads and released by timeline value
+  uint64_t lastSubmitted = 0; // Timeline value of the last submitted batch
+  uint64_t completedValue = 0; // Last timeline value known to be reached
+
+  Batch recording; // Batch copies are currently recorded into
+  bool recordingActive = false;
+  std::deque<Batch> inFlight; // Submitted batches, oldest first
+  std::vector<VkCommandBuffer> freeCommandBuffers; // Of completed batches, ready to be reused
+
+  std::vector<VkBufferMemoryBarrier> pendingAcquires; // Released, but not yet acquired by the graphics queue
+  uint64_t pendingAcquireValue = 0; // Timeline value of the last batch since the last recordAcquire
+
+  void beginBatch() {
+    if (recordingActive) {
+      return;
+    }
+
+    if (!freeCommandBuffers.empty()) {
+      recording.commandBuffer = freeCommandBuffers.back();
+      freeCommandBuffers.pop_back();
+      vkResetCommandBuffer(recording.commandBuffer, 0);
+    } else {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = commandPool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+
+      if (vkAllocateCommandBuffers(device, &allocInfo, &recording.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate upload command buffer!");
+      }
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(recording.commandBuffer, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording upload command buffer!");
+    }
+    recordingActive = true;
+  }
+
+  // Finds ring space for size bytes. When the ring is full the batch being
+  //  recorded is submitted if nothing else is in flight, and the oldest
+  //  batch waited on, which never happens once uploads settle
+  VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment) {
+    while (true) {
+      bool idle = inFlight.empty() && !recordingActive;
+      if (std::optional<VkDeviceSize> offset = stagingSpace.reserve(size, alignment, idle)) {
+        beginBatch();
+        return *offset;
+      }
+
+      if (inFlight.empty()) {
+        submit();
+      }
+      wait(inFlight.front().timelineValue);
+      collect();
+    }
+  }
+
+  // Releases the ring space of completed batches and recycles their command buffers
+  void collect() {
+    while (!inFlight.empty() && isComplete(inFlight.front().timelineValue)) {
+      Batch& batch = inFlight.front();
+      stagingSpace.release(batch.stagingEnd);
+      freeCommandBuffers.push_back(batch.commandBuffer);
+      inFlight.pop_front();
+    }
+  }
+};
@@ -0,0 +1,364 @@
+// Benchmark harness, built as VulkanBench by `make bench`. Runs VulkanTest
+//  headless through a fixed set of scenarios, collects the stats JSON each
+//  run writes, and compares the results against a stored baseline, failing
+//  when any of them got worse by more than the threshold
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Times every scenario is run, each result is the median over the runs
+const uint32_t DEFAULT_RUNS = 3;
+
+// How much worse than the baseline a result may get, in percent
+const double DEFAULT_THRESHOLD_PERCENT = 10.0;
+
+// Timings below this many milliseconds are mostly noise, a timing only
+//  regresses when it also got worse by at least this much
+const double NOISE_FLOOR_MS = 0.05;
+
+// A run of VulkanTest, on top of --headless and a disabled pipeline cache,
+//  so pipeline creation is timed from scratch every time
+struct Scenario {
+  const char* name;
+  const char* arguments;
+};
+
+// Startup alone, then throughput with more and more quads (two triangles
+//  each), then the CPU side with a draw per instance, recorded inline and
+//  by jobs, and finally GPU culling
+const std::vector<Scenario> scenarios = {
+  {"startup", "--frames 1"},
+  {"quad", "--frames 300"},
+  {"instances_10k", "--frames 300 --instances 10000"},
+  {"instances_100k", "--frames 200 --instances 100000"},
+  {"instances_1m", "--frames 100 --instances 1000000"},
+  {"draws_10k", "--frames 100 --instances 10000 --draws 10000"},
+  {"draws_10k_jobs", "--frames 100 --instances 10000 --draws 10000 --record-threads 4"},
+  {"gpu_culling_100k", "--frames 200 --instances 100000 --gpu-culling"}
+};
+
+// Results are a flat map from "scenario.result" to its value
+using Results = std::map<std::string, double>;
+
+// Helper struct to hold the options parsed from the command line
+struct BenchOptions {
+  std::string appPath = "./VulkanTest"; // Binary benchmarked
+  std::string baselinePath = "bench_baseline.json"; // Results compared against
+  std::string outputDir = "bench_results"; // Where the stats, logs and results of every run go
+  uint32_t runs = DEFAULT_RUNS;
+  double thresholdPercent = DEFAULT_THRESHOLD_PERCENT;
+  bool updateBaseline = false; // Write the results as the new baseline instead of comparing
+};
+
+// Reads JSON numbers into a flat map, with the keys of nested objects
+//  joined by dots. Strings, booleans and arrays are parsed and skipped,
+//  which is all the stats files and baselines need
+class JsonReader {
+public:
+  explicit JsonReader(const std::string& text) : text(text) {}
+
+  Results read() {
+    Results values;
+    readValue("", values);
+    skipSpace();
+    if (position != text.size()) {
+      fail("trailing characters");
+    }
+    return values;
+  }
+
+private:
+  const std::string& text;
+  size_t position = 0;
+
+  void readValue(const std::string& key, Results& values) {
+    skipSpace();
+    if (position == text.size()) {
+      fail("unexpected end");
+    }
+
+    char c = text[position];
+    if (c == '{') {
+      position++;
+      skipSpace();
+      if (peek() == '}') {position++; return;}
+      while (true) {
+        skipSpace();
+        std::string name = readString();
+        skipSpace();
+        expect(':');
+        readValue(key.empty() ? name : key + "." + name, values);
+        skipSpace();
+        if (peek() == ',') {position++; continue;}
+        expect('}');
+        return;
+      }
+    } else if (c == '[') {
+      position++;
+      skipSpace();
+      if (peek() == ']') {position++; return;}
+      Results ignored;
+      while (true) {
+        readValue("", ignored);
+        skipSpace();
+        if (peek() == ',') {position++; continue;}
+        expect(']');
+        return;
+      }
+    } else if (c == '"') {
+      readString();
+    } else if (text.compare(position, 4, "true") == 0 || text.compare(position, 4, "null") == 0) {
+      position += 4;
+    } else if (text.compare(position, 5, "false") == 0) {
+      position += 5;
+    } else {
+      // Number, which std::stod also accepts as "nan" or "inf" from a stream
+      size_t length = 0;
+      try {
+        values[key] = std::stod(text.substr(position, 32), &length);
+      } catch (const std::exception&) {
+        fail("expected a value");
+      }
+      position += length;
+    }
+  }
+
+  std::string readString() {
+    expect('"');
+    std::string result;
+    while (position < text.size() && text[position] != '"') {
+      if (text[position] == '\\') {position++;}
+      result += text[position++];
+    }
+    expect('"');
+    return result;
+  }
+
+  char peek() const {return position < text.size() ? text[position] : '\0';}
+
+  void expect(char c) {
+    if (peek() != c) {
+      fail(std::string("expected '") + c + "'");
+    }
+    position++;
+  }
+
+  void skipSpace() {
+    while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+      position++;
+    }
+  }
+
+  [[noreturn]] void fail(const std::string& message) const {
+    throw std::runtime_error("invalid JSON at offset " + std::to_string(position) + ": " + message);
+  }
+};
+
+Results readJsonFile(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + filename);
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return JsonReader(contents.str()).read();
+}
+
+void writeJsonFile(const std::string& filename, const Results& results) {
+  std::ofstream file(filename);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + filename);
+  }
+  file << "{";
+  const char* separator = "";
+  for (const auto& [name, value] : results) {
+    file << separator << "\n  \"" << name << "\": " << value;
+    separator = ",";
+  }
+  file << "\n}\n";
+}
+
+// Throughput, where more is better. Everything else is a time or a count
+bool higherIsBetter(const std::string& name) {
+  return name.size() > 6 && name.compare(name.size() - 6, 6, "_per_s") == 0;
+}
+
+// Milliseconds, such as frame_ms_p50 or startup_ms
+bool isTiming(const std::string& name) {
+  return name.find("_ms") != std::string::npos;
+}
+
+// Picks the results of a run out of the stats VulkanTest wrote
+Results extractResults(const Results& stats) {
+  Results results;
+  auto copy = [&](const std::string& from, const std::string& to) {
+    auto it = stats.find(from);
+    // Negative percentiles mean there were no samples, such as GPU times without timestamps
+    if (it != stats.end() && it->second >= 0.0) {
+      results[to] = it->second;
+    }
+  };
+
+  copy("metrics.startup_ms", "startup_ms");
+  copy("metrics.pipeline_create_ms", "pipeline_create_ms");
+  copy("metrics.steady_state_allocations", "steady_state_allocations");
+  for (const char* timing : {"frame_ms", "gpu_ms", "update_ms", "record_ms"}) {
+    copy(std::string("percentiles.") + timing + ".p50", std::string(timing) + "_p50");
+    copy(std::string("percentiles.") + timing + ".p95", std::string(timing) + "_p95");
+  }
+
+  // Triangles drawn per second, going by the median frame
+  auto triangles = stats.find("metrics.triangles_per_frame");
+  auto frameMs = results.find("frame_ms_p50");
+  if (triangles != stats.end() && frameMs != results.end() && frameMs->second > 0.0) {
+    results["triangles_per_s"] = triangles->second * 1000.0 / frameMs->second;
+  }
+  return results;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t middle = values.size() / 2;
+  return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+}
+
+// Runs scenario options.runs times and returns the median of every result
+Results runScenario(const Scenario& scenario, const BenchOptions& options) {
+  std::map<std::string, std::vector<double>> samples;
+  for (uint32_t run = 0; run < options.runs; run++) {
+    std::string prefix = options.outputDir + "/" + scenario.name + "_" + std::to_string(run);
+    std::string command = options.appPath + " --headless --pipeline-cache \"\" --stats-json " + prefix + ".json " +
+        scenario.arguments + " > " + prefix + ".log 2>&1";
+    if (std::system(command.c_str()) != 0) {
+      throw std::runtime_error(std::string("scenario ") + scenario.name + " failed, see " + prefix + ".log");
+    }
+
+    for (const auto& [name, value] : extractResults(readJsonFile(prefix + ".json"))) {
+      samples[name].push_back(value);
+    }
+  }
+
+  Results results;
+  for (const auto& [name, values] : samples) {
+    results[std::string(scenario.name) + "." + name] = median(values);
+  }
+  return results;
+}
+
+// Prints every result next to its baseline and returns how many regressed.
+//  Results missing from the baseline, such as newly added ones, are only
+//  printed, baseline results missing from the run count as regressions
+uint32_t compareResults(const Results& results, const Results& baseline, double thresholdPercent) {
+  double threshold = thresholdPercent / 100.0;
+  uint32_t regressions = 0;
+
+  for (const auto& [name, value] : results) {
+    auto it = baseline.find(name);
+    if (it == baseline.end()) {
+      std::cout << "  " << name << " " << value << " (no baseline)" << std::endl;
+      continue;
+    }
+    double base = it->second;
+
+    bool regressed;
+    if (higherIsBetter(name)) {
+      regressed = value < base * (1.0 - threshold);
+    } else {
+      double slack = isTiming(name) ? NOISE_FLOOR_MS : 0.0;
+      regressed = value > base * (1.0 + threshold) + slack;
+    }
+    regressions += regressed ? 1 : 0;
+
+    std::cout << "  " << name << " " << value << " (baseline " << base;
+    if (base != 0.0) {
+      std::cout << ", " << (value - base) / base * 100.0 << "%";
+    }
+    std::cout << ")" << (regressed ? " REGRESSED" : "") << std::endl;
+  }
+
+  for (const auto& [name, value] : baseline) {
+    if (results.find(name) == results.end()) {
+      std::cout << "  " << name << " missing, baseline " << value << " REGRESSED" << std::endl;
+      regressions++;
+    }
+  }
+  return regressions;
+}
+
+BenchOptions parseOptions(int argc, char* argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--app" && i + 1 < argc) {
+      options.appPath = argv[++i];
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      options.baselinePath = argv[++i];
+    } else if (arg == "--output" && i + 1 < argc) {
+      options.outputDir = argv[++i];
+    } else if (arg == "--runs" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 1) {
+        throw std::runtime_error("--runs must be at least 1!");
+      }
+      options.runs = static_cast<uint32_t>(value);
+    } else if (arg == "--threshold" && i + 1 < argc) {
+      options.thresholdPercent = std::atof(argv[++i]);
+      if (options.thresholdPercent < 0.0) {
+        throw std::runtime_error("--threshold must not be negative!");
+      }
+    } else if (arg == "--update-baseline") {
+      options.updateBaseline = true;
+    } else {
+      throw std::runtime_error("unknown argument: " + arg);
+    }
+  }
+  return options;
+}
+
+int main(int argc, char* argv[]) {
+  try {
+    BenchOptions options = parseOptions(argc, argv);
+    // Without a baseline there is nothing to compare against, which must
+    //  not pass as no regressions, so this fails before running anything
+    if (!options.updateBaseline && !std::filesystem::exists(options.baselinePath)) {
+      throw std::runtime_error("no baseline at " + options.baselinePath + ", record one with `make bench-baseline`!");
+    }
+    std::filesystem::create_directories(options.outputDir);
+
+    Results results;
+    for (const Scenario& scenario : scenarios) {
+      std::cout << "running " << scenario.name << " (" << scenario.arguments << ") " << options.runs << " time(s)" << std::endl;
+      Results scenarioResults = runScenario(scenario, options);
+      results.insert(scenarioResults.begin(), scenarioResults.end());
+    }
+    writeJsonFile(options.outputDir + "/results.json", results);
+
+    if (options.updateBaseline) {
+      writeJsonFile(options.baselinePath, results);
+      std::cout << "wrote baseline " << options.baselinePath << std::endl;
+      return EXIT_SUCCESS;
+    }
+
+    std::cout << "results against " << options.baselinePath << ", threshold " << options.thresholdPercent << "%:" << std::endl;
+    uint32_t regressions = compareResults(results, readJsonFile(options.baselinePath), options.thresholdPercent);
+    if (regressions > 0) {
+      std::cerr << regressions << " result(s) regressed" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << "no regressions" << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
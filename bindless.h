@@ -0,0 +1,215 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Hands out indices into a fixed size array. Freed indices are reused, most
+//  recently freed first, before any index that was never handed out
+class SlotAllocator {
+public:
+  void init(uint32_t capacity) {
+    this->capacity = capacity;
+    next = 0;
+    freeSlots.clear();
+  }
+
+  uint32_t allocate() {
+    if (!freeSlots.empty()) {
+      uint32_t slot = freeSlots.back();
+      freeSlots.pop_back();
+      return slot;
+    }
+    if (next == capacity) {
+      throw std::runtime_error("out of bindless descriptor slots!");
+    }
+    return next++;
+  }
+
+  void free(uint32_t slot) {
+    freeSlots.push_back(slot);
+  }
+
+  uint32_t used() const {return next - static_cast<uint32_t>(freeSlots.size());}
+
+private:
+  uint32_t capacity = 0;
+  uint32_t next = 0; // Slots from here on were never handed out
+  std::vector<uint32_t> freeSlots;
+};
+
+// Slots of each array in the bindless set. Devices supporting update after
+//  bind allow at least 500000 descriptors per stage, far more than these
+const uint32_t BINDLESS_MAX_TEXTURES = 4096;
+const uint32_t BINDLESS_MAX_BUFFERS = 1024;
+
+// Bindings of the arrays, as declared in shaders/bindless.frag
+const uint32_t BINDLESS_TEXTURE_BINDING = 0;
+const uint32_t BINDLESS_BUFFER_BINDING = 1;
+
+// Whether features, VkPhysicalDeviceVulkan12Features or
+//  VkPhysicalDeviceDescriptorIndexingFeatures, have everything BindlessHeap
+//  needs. Indexing the texture array dynamically also takes the core
+//  shaderSampledImageArrayDynamicIndexing feature
+template <typename Features>
+bool hasBindlessFeatures(const Features& features) {
+  return features.runtimeDescriptorArray && features.descriptorBindingPartiallyBound &&
+      features.descriptorBindingSampledImageUpdateAfterBind;
+}
+
+template <typename Features>
+void enableBindlessFeatures(Features& features) {
+  features.runtimeDescriptorArray = VK_TRUE;
+  features.descriptorBindingPartiallyBound = VK_TRUE;
+  features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+}
+
+// One descriptor set holding an array of textures and one of storage
+//  buffers, bound once per command buffer instead of a set per draw or
+//  frame. Shaders pick resources by the slot they were added at.
+//  Texture slots are written with update after bind, so textures are added
+//  while recorded command buffers have the set bound, and the arrays are
+//  partially bound, so unwritten slots are fine as long as nothing reads them.
+//  No shader reads the buffer array yet, so it doesn't ask devices for
+//  update after bind of storage buffers: buffers have to be added before
+//  the set is bound by a command buffer that is recorded or pending.
+//  A slot a frame in flight may read must not be rewritten, so resources
+//  changing go to a new slot and the old one is removed once those frames are done
+class BindlessHeap {
+public:
+  void init(VkDevice device) {
+    this->device = device;
+    textureSlots.init(BINDLESS_MAX_TEXTURES);
+    bufferSlots.init(BINDLESS_MAX_BUFFERS);
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = BINDLESS_MAX_TEXTURES;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = BINDLESS_BUFFER_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = BINDLESS_MAX_BUFFERS;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorBindingFlags bindingFlags[2] = {
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = 2;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create bindless descriptor set layout!");
+    }
+
+    // Sized for exactly the one set
+    VkDescriptorPoolSize poolSizes[] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, BINDLESS_MAX_TEXTURES},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BINDLESS_MAX_BUFFERS}
+    };
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create bindless descriptor pool!");
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate bindless descriptor set!");
+    }
+  }
+
+  // The set goes along with its pool
+  void destroy() {
+    if (pool != VK_NULL_HANDLE) {
+      vkDestroyDescriptorPool(device, pool, nullptr);
+      vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    }
+    pool = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    descriptorSet = VK_NULL_HANDLE;
+  }
+
+  // Writes the texture into a free slot and returns the slot, its index into
+  //  the texture array. The view must be in SHADER_READ_ONLY_OPTIMAL when sampled
+  uint32_t addTexture(VkImageView view, VkSampler sampler) {
+    uint32_t slot = textureSlots.allocate();
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = sampler;
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = BINDLESS_TEXTURE_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    return slot;
+  }
+
+  // Same for a range of a storage buffer, returns its index into the buffer
+  //  array. Only while no recorded or pending command buffer has the set bound
+  uint32_t addBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    uint32_t slot = bufferSlots.allocate();
+
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = offset;
+    bufferInfo.range = range;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = BINDLESS_BUFFER_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    return slot;
+  }
+
+  // Frees the slot for reuse, only once no frame in flight reads it anymore
+  void removeTexture(uint32_t slot) {textureSlots.free(slot);}
+  void removeBuffer(uint32_t slot) {bufferSlots.free(slot);}
+
+  VkDescriptorSetLayout layout() const {return setLayout;}
+  VkDescriptorSet set() const {return descriptorSet;}
+  uint32_t textureCount() const {return textureSlots.used();}
+  uint32_t bufferCount() const {return bufferSlots.used();}
+
+private:
+  VkDevice device;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  SlotAllocator textureSlots;
+  SlotAllocator bufferSlots;
+};
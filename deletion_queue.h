@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Holds on to objects that were replaced while frames using them may still be
+//  in flight, and destroys them once the fences of those frames have signaled.
+//  Replacing a pipeline or the swap chain's framebuffers then never has to
+//  wait for the GPU
+class DeletionQueue {
+public:
+  static constexpr uint64_t NO_SUBMISSION = ~0ULL;
+
+  void init(uint32_t framesInFlight) {
+    slotSubmissions.assign(framesInFlight, NO_SUBMISSION);
+  }
+
+  // Destroys everything right away, only once the device is idle
+  void flush() {
+    while (!pending.empty()) {
+      pending.front().destroy();
+      pending.pop_front();
+    }
+  }
+
+  // Runs destroy once every frame submitted so far is done
+  void defer(std::function<void()> destroy) {
+    pending.push_back({submissions, std::move(destroy)});
+    retiredCount++;
+  }
+
+  // Destroys the handle's object once every frame submitted so far is done with it
+  template <typename Handle>
+  void retire(Handle&& handle) {
+    VkDevice device = handle.getDevice();
+    auto object = handle.release();
+    if (object == VK_NULL_HANDLE) {return;}
+    defer([device, object] {std::decay_t<Handle>::destroy(device, object);});
+  }
+
+  // Call when a frame was submitted on frame in flight slot
+  void frameSubmitted(uint32_t slot) {
+    slotSubmissions[slot] = submissions++;
+  }
+
+  // Call once the fence of frame in flight slot has signaled. Submissions
+  //  complete in order, so everything retired before that frame is done with
+  void frameCompleted(uint32_t slot) {
+    if (slotSubmissions[slot] == NO_SUBMISSION) {return;}
+    uint64_t completed = slotSubmissions[slot] + 1;
+
+    while (!pending.empty() && pending.front().submissions <= completed) {
+      pending.front().destroy();
+      pending.pop_front();
+    }
+  }
+
+  size_t pendingCount() const {return pending.size();}
+  size_t retiredTotal() const {return retiredCount;}
+
+private:
+  struct Entry {
+    uint64_t submissions; // Frames submitted when the object was retired, all of them may use it
+    std::function<void()> destroy;
+  };
+
+  std::deque<Entry> pending; // Ordered by submissions
+  std::vector<uint64_t> slotSubmissions; // Submission number last made on each frame in flight
+  uint64_t submissions = 0;
+  size_t retiredCount = 0;
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// Creates every distinct descriptor set layout once. Layouts are keyed by
+//  their bindings, so pipelines declaring the same set share its layout
+class DescriptorLayoutCache {
+public:
+  void init(VkDevice device) {
+    this->device = device;
+  }
+
+  void destroy() {
+    for (const auto& [key, layout] : layouts) {
+      vkDestroyDescriptorSetLayout(device, layout, nullptr);
+    }
+    layouts.clear();
+  }
+
+  // Returns the layout for the bindings, in any order, creating it on first use
+  VkDescriptorSetLayout get(std::vector<VkDescriptorSetLayoutBinding> bindings) {
+    std::sort(bindings.begin(), bindings.end(), [](const auto& a, const auto& b) {return a.binding < b.binding;});
+
+    LayoutKey key{bindings};
+    auto found = layouts.find(key);
+    if (found != layouts.end()) {
+      return found->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    layouts.emplace(std::move(key), layout);
+    return layout;
+  }
+
+private:
+  struct LayoutKey {
+    std::vector<VkDescriptorSetLayoutBinding> bindings; // Sorted by binding
+
+    bool operator==(const LayoutKey& other) const {
+      return std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), other.bindings.end(), [](const auto& a, const auto& b) {
+        return a.binding == b.binding && a.descriptorType == b.descriptorType && a.descriptorCount == b.descriptorCount &&
+            a.stageFlags == b.stageFlags && a.pImmutableSamplers == b.pImmutableSamplers;
+      });
+    }
+  };
+
+  struct LayoutKeyHash {
+    size_t operator()(const LayoutKey& key) const {
+      size_t value = 0;
+      for (const auto& binding : key.bindings) {
+        // binding, type, count and stages each fit comfortably in 16 bits
+        uint64_t packed = static_cast<uint64_t>(binding.binding) |
+            static_cast<uint64_t>(binding.descriptorType) << 16 |
+            static_cast<uint64_t>(binding.descriptorCount) << 32 |
+            static_cast<uint64_t>(binding.stageFlags) << 48;
+        value ^= std::hash<uint64_t>()(packed) + 0x9e3779b97f4a7c15ULL + (value << 6) + (value >> 2);
+      }
+      return value;
+    }
+  };
+
+  VkDevice device;
+  std::unordered_map<LayoutKey, VkDescriptorSetLayout, LayoutKeyHash> layouts;
+};
+
+// Descriptors of a type a pool holds for every set it is sized for
+struct DescriptorPoolRatio {
+  VkDescriptorType type;
+  float perSet;
+};
+
+// Sets a pool is sized for when the allocator starts and at most, pools double in between
+const uint32_t DESCRIPTOR_POOL_INITIAL_SETS = 64;
+const uint32_t DESCRIPTOR_POOL_MAX_SETS = 4096;
+
+// Allocates descriptor sets out of a list of pools, adding a pool whenever the
+//  current one runs out instead of failing. Sets are never freed one by one,
+//  reset() recycles every pool at once, so pools never fragment
+class DescriptorAllocator {
+public:
+  void init(VkDevice device, const std::vector<DescriptorPoolRatio>& ratios) {
+    this->device = device;
+    this->ratios = ratios;
+    setsPerPool = DESCRIPTOR_POOL_INITIAL_SETS;
+  }
+
+  void destroy() {
+    for (VkDescriptorPool pool : usedPools) {
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    for (VkDescriptorPool pool : freePools) {
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    usedPools.clear();
+    freePools.clear();
+    currentPool = VK_NULL_HANDLE;
+  }
+
+  VkDescriptorSet allocate(VkDescriptorSetLayout layout) {
+    if (currentPool == VK_NULL_HANDLE) {
+      nextPool();
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = currentPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    // The pool is full, move on to another one and try again
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+      nextPool();
+      allocInfo.descriptorPool = currentPool;
+      result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    }
+    if (result != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate descriptor set!");
+    }
+    return set;
+  }
+
+  // Frees every set allocated so far, only once the GPU is done with all of them
+  void reset() {
+    for (VkDescriptorPool pool : usedPools) {
+      vkResetDescriptorPool(device, pool, 0);
+      freePools.push_back(pool);
+    }
+    usedPools.clear();
+    currentPool = VK_NULL_HANDLE;
+  }
+
+  size_t poolCount() const {return usedPools.size() + freePools.size();}
+
+private:
+  VkDevice device;
+  std::vector<DescriptorPoolRatio> ratios;
+  uint32_t setsPerPool; // Size of the next pool created
+  VkDescriptorPool currentPool = VK_NULL_HANDLE; // Pool sets are allocated from, the last of usedPools
+  std::vector<VkDescriptorPool> usedPools; // Pools holding sets
+  std::vector<VkDescriptorPool> freePools; // Pools that were reset, reused before creating new ones
+
+  void nextPool() {
+    if (!freePools.empty()) {
+      currentPool = freePools.back();
+      freePools.pop_back();
+    } else {
+      currentPool = createPool(setsPerPool);
+      setsPerPool = std::min(setsPerPool * 2, DESCRIPTOR_POOL_MAX_SETS);
+    }
+    usedPools.push_back(currentPool);
+  }
+
+  VkDescriptorPool createPool(uint32_t setCount) {
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for (const DescriptorPoolRatio& ratio : ratios) {
+      poolSizes.push_back({ratio.type, std::max(1u, static_cast<uint32_t>(ratio.perSet * setCount))});
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = setCount;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create descriptor pool!");
+    }
+    return pool;
+  }
+};
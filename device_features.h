@@ -0,0 +1,286 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bindless.h"
+
+// Optional device features the application knows how to use. Each is core
+//  in some Vulkan version and may come with an extension on older devices
+enum class DeviceFeature {
+  TimelineSemaphore, // Async uploads, core in Vulkan 1.2
+  DynamicRendering, // Rendering without render pass objects, core in 1.3, VK_KHR_dynamic_rendering before
+  DescriptorIndexing, // Bindless textures, core in 1.2, VK_EXT_descriptor_indexing before
+  Synchronization2, // Core in 1.3, VK_KHR_synchronization2 before
+  MultiDrawIndirect, // GPU culling, one indirect command per object starting at its instance
+  DrawIndirectCount, // GPU culling skipping culled commands, core in 1.2, VK_KHR_draw_indirect_count before
+  Count
+};
+
+// How a device provides a feature
+enum class FeatureSource {Unsupported, Core, Extension};
+
+// What a physical device supports of the DeviceFeatures, and which of them
+//  its logical device gets. query() fills in the support, enable() turns
+//  on a supported feature, and extensions() and chain() then hold exactly
+//  the extensions and feature structs vkCreateDevice needs for what was enabled
+class DeviceCapabilities {
+public:
+  DeviceCapabilities() {
+    vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    dynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    descriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+  }
+
+  void query(VkPhysicalDevice device) {
+    *this = DeviceCapabilities();
+    vkGetPhysicalDeviceProperties(device, &deviceProperties);
+    vkGetPhysicalDeviceFeatures(device, &supportedCore);
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+      if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+        largestDeviceLocalHeap = std::max(largestDeviceLocalHeap, memoryProperties.memoryHeaps[i].size);
+      }
+    }
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensionProperties.data());
+    for (const VkExtensionProperties& extension : extensionProperties) {
+      availableExtensions.push_back(extension.extensionName);
+    }
+
+    // Anything past Vulkan 1.0 is queried through vkGetPhysicalDeviceFeatures2,
+    //  core in 1.1, with a struct per version or extension
+    uint32_t apiVersion = deviceProperties.apiVersion;
+    VkPhysicalDeviceVulkan12Features supported12{};
+    supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceVulkan13Features supported13{};
+    supported13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    VkPhysicalDeviceDynamicRenderingFeatures supportedDynamicRendering{};
+    supportedDynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    VkPhysicalDeviceDescriptorIndexingFeatures supportedDescriptorIndexing{};
+    supportedDescriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    VkPhysicalDeviceSynchronization2Features supportedSynchronization2{};
+    supportedSynchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+
+    // The dynamic rendering extension depends on extensions core in 1.2, the
+    //  others only on ones core in 1.1
+    bool dynamicRenderingExtension = apiVersion < VK_API_VERSION_1_3 && apiVersion >= VK_API_VERSION_1_2 &&
+        hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    bool descriptorIndexingExtension = apiVersion < VK_API_VERSION_1_2 && apiVersion >= VK_API_VERSION_1_1 &&
+        hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    bool synchronization2Extension = apiVersion < VK_API_VERSION_1_3 && apiVersion >= VK_API_VERSION_1_1 &&
+        hasExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+
+    if (apiVersion >= VK_API_VERSION_1_1) {
+      VkPhysicalDeviceFeatures2 supportedFeatures2{};
+      supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+      void** next = &supportedFeatures2.pNext;
+      auto link = [&next](auto& features) {
+        *next = &features;
+        next = &features.pNext;
+      };
+      if (apiVersion >= VK_API_VERSION_1_2) {link(supported12);}
+      if (apiVersion >= VK_API_VERSION_1_3) {link(supported13);}
+      if (dynamicRenderingExtension) {link(supportedDynamicRendering);}
+      if (descriptorIndexingExtension) {link(supportedDescriptorIndexing);}
+      if (synchronization2Extension) {link(supportedSynchronization2);}
+      vkGetPhysicalDeviceFeatures2(device, &supportedFeatures2);
+    }
+
+    auto set = [this](DeviceFeature feature, bool core, bool extension) {
+      sources[index(feature)] = core ? FeatureSource::Core : extension ? FeatureSource::Extension : FeatureSource::Unsupported;
+    };
+    set(DeviceFeature::TimelineSemaphore, supported12.timelineSemaphore, false);
+    set(DeviceFeature::DynamicRendering, supported13.dynamicRendering, supportedDynamicRendering.dynamicRendering);
+    // Bindless shaders index the texture array with a value that isn't constant, which is a core feature
+    bool dynamicIndexing = supportedCore.shaderSampledImageArrayDynamicIndexing;
+    set(DeviceFeature::DescriptorIndexing, dynamicIndexing && hasBindlessFeatures(supported12),
+        dynamicIndexing && hasBindlessFeatures(supportedDescriptorIndexing));
+    set(DeviceFeature::Synchronization2, supported13.synchronization2, supportedSynchronization2.synchronization2);
+    set(DeviceFeature::MultiDrawIndirect, supportedCore.multiDrawIndirect && supportedCore.drawIndirectFirstInstance, false);
+    set(DeviceFeature::DrawIndirectCount, supported12.drawIndirectCount, hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME));
+  }
+
+  FeatureSource source(DeviceFeature feature) const {return sources[index(feature)];}
+  bool supports(DeviceFeature feature) const {return source(feature) != FeatureSource::Unsupported;}
+  bool isEnabled(DeviceFeature feature) const {return enabled[index(feature)];}
+
+  bool hasExtension(const char* name) const {
+    return std::find(availableExtensions.begin(), availableExtensions.end(), name) != availableExtensions.end();
+  }
+
+  // Enables the feature if the device supports it, returns whether it did
+  bool enable(DeviceFeature feature) {
+    FeatureSource from = source(feature);
+    if (from == FeatureSource::Unsupported) {
+      return false;
+    }
+    enabled[index(feature)] = true;
+    bool core = from == FeatureSource::Core;
+
+    switch (feature) {
+      case DeviceFeature::TimelineSemaphore:
+        vulkan12.timelineSemaphore = VK_TRUE;
+        break;
+      case DeviceFeature::DynamicRendering:
+        if (core) {
+          vulkan13.dynamicRendering = VK_TRUE;
+        } else {
+          dynamicRendering.dynamicRendering = VK_TRUE;
+          enableExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        }
+        break;
+      case DeviceFeature::DescriptorIndexing:
+        enabledCore.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        if (core) {
+          enableBindlessFeatures(vulkan12);
+        } else {
+          enableBindlessFeatures(descriptorIndexing);
+          enableExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        }
+        break;
+      case DeviceFeature::Synchronization2:
+        if (core) {
+          vulkan13.synchronization2 = VK_TRUE;
+        } else {
+          synchronization2.synchronization2 = VK_TRUE;
+          enableExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        }
+        break;
+      case DeviceFeature::MultiDrawIndirect:
+        enabledCore.multiDrawIndirect = VK_TRUE;
+        enabledCore.drawIndirectFirstInstance = VK_TRUE;
+        break;
+      case DeviceFeature::DrawIndirectCount:
+        if (core) {
+          vulkan12.drawIndirectCount = VK_TRUE;
+        } else {
+          enableExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
+        break;
+      case DeviceFeature::Count:
+        break;
+    }
+    return true;
+  }
+
+  // Extensions without features of their own, such as VK_KHR_swapchain
+  void enableExtension(const char* name) {
+    enabledExtensions.push_back(name);
+  }
+
+  // For VkDeviceCreateInfo. chain() links the feature structs of the device's
+  //  version and of the extensions enabled, valid as long as this isn't moved
+  const VkPhysicalDeviceFeatures* coreFeatures() const {return &enabledCore;}
+  const std::vector<const char*>& extensions() const {return enabledExtensions;}
+
+  const void* chain() {
+    void* head = nullptr;
+    void** next = &head;
+    auto link = [&next](auto& features) {
+      *next = &features;
+      next = &features.pNext;
+    };
+    if (deviceProperties.apiVersion >= VK_API_VERSION_1_2) {link(vulkan12);}
+    if (deviceProperties.apiVersion >= VK_API_VERSION_1_3) {link(vulkan13);}
+    if (enabledThrough(DeviceFeature::DynamicRendering, FeatureSource::Extension)) {link(dynamicRendering);}
+    if (enabledThrough(DeviceFeature::DescriptorIndexing, FeatureSource::Extension)) {link(descriptorIndexing);}
+    if (enabledThrough(DeviceFeature::Synchronization2, FeatureSource::Extension)) {link(synchronization2);}
+    *next = nullptr;
+    return head;
+  }
+
+  const VkPhysicalDeviceProperties& properties() const {return deviceProperties;}
+  VkDeviceSize deviceLocalBytes() const {return largestDeviceLocalHeap;}
+
+  static const char* name(DeviceFeature feature) {
+    switch (feature) {
+      case DeviceFeature::TimelineSemaphore: return "timeline semaphores";
+      case DeviceFeature::DynamicRendering: return "dynamic rendering";
+      case DeviceFeature::DescriptorIndexing: return "descriptor indexing";
+      case DeviceFeature::Synchronization2: return "synchronization2";
+      case DeviceFeature::MultiDrawIndirect: return "multi draw indirect";
+      case DeviceFeature::DrawIndirectCount: return "draw indirect count";
+      case DeviceFeature::Count: break;
+    }
+    return "unknown";
+  }
+
+  // Lists the device, then every feature as enabled, supported but unused, or unsupported
+  void print(std::ostream& out) const {
+    uint32_t version = deviceProperties.apiVersion;
+    out << "device: " << deviceProperties.deviceName << " (" << typeName(deviceProperties.deviceType) << ", Vulkan "
+        << VK_API_VERSION_MAJOR(version) << "." << VK_API_VERSION_MINOR(version) << "." << VK_API_VERSION_PATCH(version)
+        << "), " << (largestDeviceLocalHeap >> 20) << " MiB device local" << std::endl;
+
+    for (size_t i = 0; i < FEATURE_COUNT; i++) {
+      DeviceFeature feature = static_cast<DeviceFeature>(i);
+      out << "  " << name(feature) << ": ";
+      if (enabled[i]) {
+        out << "enabled";
+      } else if (supports(feature)) {
+        out << "supported, not used";
+      } else {
+        out << "unsupported";
+      }
+      if (supports(feature)) {
+        out << (source(feature) == FeatureSource::Core ? " (core)" : " (extension)");
+      }
+      out << std::endl;
+    }
+
+    out << "  extensions:";
+    for (const char* extension : enabledExtensions) {
+      out << " " << extension;
+    }
+    out << (enabledExtensions.empty() ? " none" : "") << std::endl;
+  }
+
+private:
+  static constexpr size_t FEATURE_COUNT = static_cast<size_t>(DeviceFeature::Count);
+
+  VkPhysicalDeviceProperties deviceProperties{};
+  VkPhysicalDeviceFeatures supportedCore{};
+  VkDeviceSize largestDeviceLocalHeap = 0;
+  std::vector<std::string> availableExtensions;
+  std::array<FeatureSource, FEATURE_COUNT> sources{};
+  std::array<bool, FEATURE_COUNT> enabled{};
+
+  // Enabled features, handed to vkCreateDevice
+  VkPhysicalDeviceFeatures enabledCore{};
+  VkPhysicalDeviceVulkan12Features vulkan12{};
+  VkPhysicalDeviceVulkan13Features vulkan13{};
+  VkPhysicalDeviceDynamicRenderingFeatures dynamicRendering{};
+  VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexing{};
+  VkPhysicalDeviceSynchronization2Features synchronization2{};
+  std::vector<const char*> enabledExtensions;
+
+  static size_t index(DeviceFeature feature) {return static_cast<size_t>(feature);}
+
+  bool enabledThrough(DeviceFeature feature, FeatureSource from) const {
+    return isEnabled(feature) && source(feature) == from;
+  }
+
+  static const char* typeName(VkPhysicalDeviceType type) {
+    switch (type) {
+      case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete GPU";
+      case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated GPU";
+      case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual GPU";
+      case VK_PHYSICAL_DEVICE_TYPE_CPU: return "CPU";
+      default: return "other";
+    }
+  }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <utility>
+
+// Owns one object created from a VkDevice and destroys it with Destroy when
+//  the wrapper is destroyed or given a new object. Move only, so an object has
+//  exactly one owner. Converts to the plain handle, so it can be passed to
+//  Vulkan calls as is
+template <typename T, void (VKAPI_PTR* Destroy)(VkDevice, T, const VkAllocationCallbacks*)>
+class DeviceHandle {
+public:
+  DeviceHandle() = default;
+  DeviceHandle(VkDevice device, T handle) : device(device), handle(handle) {}
+
+  ~DeviceHandle() {reset();}
+
+  DeviceHandle(DeviceHandle&& other) noexcept
+    : device(std::exchange(other.device, VK_NULL_HANDLE)), handle(std::exchange(other.handle, VK_NULL_HANDLE)) {}
+
+  DeviceHandle& operator=(DeviceHandle&& other) noexcept {
+    if (this != &other) {
+      reset();
+      device = std::exchange(other.device, VK_NULL_HANDLE);
+      handle = std::exchange(other.handle, VK_NULL_HANDLE);
+    }
+    return *this;
+  }
+
+  DeviceHandle(const DeviceHandle&) = delete;
+  DeviceHandle& operator=(const DeviceHandle&) = delete;
+
+  operator T() const {return handle;}
+  T get() const {return handle;}
+  VkDevice getDevice() const {return device;}
+
+  // Destroys the object right away, only for objects the GPU is done with
+  void reset() {
+    if (handle != VK_NULL_HANDLE) {
+      Destroy(device, handle, nullptr);
+      handle = VK_NULL_HANDLE;
+    }
+  }
+
+  // Gives up ownership without destroying the object
+  T release() {
+    return std::exchange(handle, VK_NULL_HANDLE);
+  }
+
+  // Destroys the current object and returns where vkCreate* writes the new one
+  T* put(VkDevice device) {
+    reset();
+    this->device = device;
+    return &handle;
+  }
+
+  static void destroy(VkDevice device, T handle) {
+    Destroy(device, handle, nullptr);
+  }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  T handle = VK_NULL_HANDLE;
+};
+
+using SwapchainHandle = DeviceHandle<VkSwapchainKHR, vkDestroySwapchainKHR>;
+using ImageViewHandle = DeviceHandle<VkImageView, vkDestroyImageView>;
+using FramebufferHandle = DeviceHandle<VkFramebuffer, vkDestroyFramebuffer>;
+using RenderPassHandle = DeviceHandle<VkRenderPass, vkDestroyRenderPass>;
+using PipelineHandle = DeviceHandle<VkPipeline, vkDestroyPipeline>;
+using PipelineLayoutHandle = DeviceHandle<VkPipelineLayout, vkDestroyPipelineLayout>;
+using PipelineCacheHandle = DeviceHandle<VkPipelineCache, vkDestroyPipelineCache>;
+using DescriptorSetLayoutHandle = DeviceHandle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>;
+using DescriptorPoolHandle = DeviceHandle<VkDescriptorPool, vkDestroyDescriptorPool>;
+using CommandPoolHandle = DeviceHandle<VkCommandPool, vkDestroyCommandPool>;
+using QueryPoolHandle = DeviceHandle<VkQueryPool, vkDestroyQueryPool>;
+using SemaphoreHandle = DeviceHandle<VkSemaphore, vkDestroySemaphore>;
+using FenceHandle = DeviceHandle<VkFence, vkDestroyFence>;
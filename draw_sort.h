@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Sort key of a draw. Draws are grouped by pipeline in the upper 32 bits,
+//  then ordered by depth in the lower ones. Depths are non negative floats,
+//  whose bits order the same way as their values when read as integers
+inline uint64_t makeDrawSortKey(uint32_t pipeline, float depth) {
+  uint32_t depthBits;
+  memcpy(&depthBits, &depth, sizeof(depthBits));
+  return static_cast<uint64_t>(pipeline) << 32 | depthBits;
+}
+
+// Returns the indices of keys in ascending key order, equal keys keep their
+//  order. LSD radix sort over bytes, which is linear in the amount of draws
+//  where std::sort isn't. Bytes every key has in common, such as the
+//  pipeline while there is only one, take no pass
+inline std::vector<uint32_t> radixSortDraws(const std::vector<uint64_t>& keys) {
+  size_t count = keys.size();
+  std::vector<uint32_t> order(count), scratch(count);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = static_cast<uint32_t>(i);
+  }
+
+  for (uint32_t shift = 0; shift < 64; shift += 8) {
+    std::array<size_t, 256> offsets{};
+    for (uint64_t key : keys) {
+      offsets[(key >> shift) & 0xff]++;
+    }
+    if (count == 0 || offsets[(keys[0] >> shift) & 0xff] == count) {
+      continue; // Every key has the same byte here
+    }
+
+    // Counts to where each byte value's run starts
+    size_t start = 0;
+    for (size_t& offset : offsets) {
+      size_t runLength = offset;
+      offset = start;
+      start += runLength;
+    }
+    for (uint32_t index : order) {
+      scratch[offsets[(keys[index] >> shift) & 0xff]++] = index;
+    }
+    order.swap(scratch);
+  }
+  return order;
+}
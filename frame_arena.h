@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Size of the blocks a frame arena allocates from. A frame needing more
+//  adds blocks, which are kept, so only the first frames allocate them
+const size_t FRAME_ARENA_BLOCK_SIZE = 64 * 1024;
+
+// Operator new calls so far, counted by the replacement operator new in
+//  main.cpp. Comparing it before and after a stretch of code shows whether
+//  that code touched the heap
+inline std::atomic<uint64_t> heapAllocationCount{0};
+
+// Bump allocator for CPU side data that only lives while a frame is built,
+//  such as barrier and submit lists. Allocating moves a pointer forward and
+//  freeing does nothing, reset() drops everything at once at the frame
+//  boundary and keeps the blocks for the next frame. One arena per frame in
+//  flight, so a frame's data is never reset while that frame is being
+//  recorded. Not thread safe, each arena belongs to the thread recording its frame
+class FrameArena {
+public:
+  FrameArena() = default;
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+  FrameArena(FrameArena&&) = default;
+  FrameArena& operator=(FrameArena&&) = default;
+
+  // alignment must be a power of two
+  void* allocate(size_t size, size_t alignment) {
+    while (current < blocks.size()) {
+      Block& block = blocks[current];
+      uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+      size_t offset = ((base + head + alignment - 1) & ~(alignment - 1)) - base;
+      if (offset + size <= block.size) {
+        // Alignment padding counts too, it takes up the block all the same
+        used += offset - head + size;
+        head = offset + size;
+        highWater = std::max(highWater, used);
+        return block.data.get() + offset;
+      }
+      // Doesn't fit the rest of this block, move on to the next one
+      current++;
+      head = 0;
+    }
+
+    // Every block is full, only happens until the arena has grown to what a frame needs
+    size_t blockSize = std::max(FRAME_ARENA_BLOCK_SIZE, size + alignment);
+    blocks.push_back({std::make_unique<char[]>(blockSize), blockSize});
+    return allocate(size, alignment);
+  }
+
+  template <typename T>
+  T* allocate(size_t count) {
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Everything allocated so far must be unused
+  void reset() {
+    current = 0;
+    head = 0;
+    used = 0;
+  }
+
+  size_t blockCount() const {return blocks.size();}
+  size_t highWaterBytes() const {return highWater;} // Most bytes a frame took, padding included
+
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks;
+  size_t current = 0; // Block allocated from
+  size_t head = 0; // Next free byte of the current block
+  size_t used = 0; // Bytes allocated since reset, with their alignment padding
+  size_t highWater = 0;
+};
+
+// Standard allocator handing out arena memory, so standard containers can
+//  hold frame data. Deallocating does nothing, the memory returns on reset,
+//  so containers growing in a loop leave their old storage behind until then
+template <typename T>
+class ArenaAllocator {
+public:
+  using value_type = T;
+
+  explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t count) {return arena->allocate<T>(count);}
+  void deallocate(T*, size_t) {}
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {return arena == other.arena;}
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {return arena != other.arena;}
+
+private:
+  template <typename U> friend class ArenaAllocator;
+  FrameArena* arena;
+};
+
+// Vector whose storage lives in a frame arena, valid until the arena's next reset
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
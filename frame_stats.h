@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Adds the time spent in its scope, in milliseconds, to target when destroyed
+class ScopedTimer {
+public:
+  explicit ScopedTimer(double& target) : target(target), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    target += elapsed.count();
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+  double& target;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Timings of a single frame, all in milliseconds
+struct FrameTimings {
+  uint64_t frameNumber = 0;
+  double frameMs = 0.0; // Time since the start of the previous frame
+  double waitMs = 0.0; // Waiting on the frame's fence
+  double acquireMs = 0.0; // vkAcquireNextImageKHR
+  double updateMs = 0.0; // Updating per frame data such as instances
+  double recordMs = 0.0; // Recording the command buffer
+  double submitMs = 0.0; // vkQueueSubmit
+  double presentMs = 0.0; // vkQueuePresentKHR
+  double gpuMs = -1.0; // Render pass time from GPU timestamps, negative until known
+};
+
+// Keeps the timings of the last `capacity` frames in a ring buffer and
+//  reports percentiles over them, as CSV or as JSON
+class FrameStats {
+public:
+  explicit FrameStats(size_t capacity = 10000) : frames(capacity) {}
+
+  // Records the CPU timings of a frame, overwriting the oldest one when full
+  void recordFrame(const FrameTimings& timings) {
+    frames[next] = timings;
+    next = (next + 1) % frames.size();
+    count = std::min(count + 1, frames.size());
+  }
+
+  // GPU results arrive frames later, once the frame's fence has signaled
+  void recordGpuTime(uint64_t frameNumber, double gpuMs) {
+    for (size_t i = 0; i < count; i++) {
+      FrameTimings& timings = frames[(next + frames.size() - 1 - i) % frames.size()];
+      if (timings.frameNumber == frameNumber) {
+        timings.gpuMs = gpuMs;
+        return;
+      }
+    }
+  }
+
+  // Scalar values, such as startup times, reported along with the frames
+  void setMetric(const std::string& name, double value) {
+    metrics[name] = value;
+  }
+
+  // Returns the p-th percentile (0-100) of a timing, or -1 without samples
+  double percentile(double FrameTimings::*field, double p) const {
+    std::vector<double> values = collect(field);
+    if (values.empty()) {
+      return -1.0;
+    }
+    std::sort(values.begin(), values.end());
+
+    // Nearest rank percentile
+    size_t rank = static_cast<size_t>(p / 100.0 * values.size() + 0.5);
+    rank = std::clamp<size_t>(rank, 1, values.size());
+    return values[rank - 1];
+  }
+
+  size_t frameCount() const {return count;}
+
+  // Drops the recorded frames, keeping the metrics
+  void clear() {
+    next = 0;
+    count = 0;
+  }
+
+  void printSummary(std::ostream& out) const {
+    out << "frame stats over the last " << count << " frames:" << std::endl;
+    for (const auto& [name, field] : fields()) {
+      if (percentile(field, 50) < 0.0) {continue;}
+      out << "  " << std::left << std::setw(11) << name << std::right << std::fixed << std::setprecision(3)
+          << " p50 " << percentile(field, 50) << " ms"
+          << "  p95 " << percentile(field, 95) << " ms"
+          << "  p99 " << percentile(field, 99) << " ms" << std::endl;
+    }
+    out << std::defaultfloat;
+    for (const auto& [name, value] : metrics) {
+      out << "  " << name << " " << value << std::endl;
+    }
+  }
+
+  // One row per frame, oldest first
+  void writeCsv(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open stats file " + filename);
+    }
+
+    file << "frame";
+    for (const auto& field : fields()) {
+      file << "," << field.first;
+    }
+    file << "\n";
+
+    for (size_t i = 0; i < count; i++) {
+      const FrameTimings& timings = at(i);
+      file << timings.frameNumber;
+      for (const auto& field : fields()) {
+        file << "," << timings.*field.second;
+      }
+      file << "\n";
+    }
+  }
+
+  // Percentiles and metrics up front, then the individual frames
+  void writeJson(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open stats file " + filename);
+    }
+
+    file << "{\n  \"frames\": " << count << ",\n  \"metrics\": {";
+    const char* separator = "";
+    for (const auto& [name, value] : metrics) {
+      file << separator << "\n    \"" << name << "\": " << value;
+      separator = ",";
+    }
+    file << "\n  },\n  \"percentiles\": {";
+    separator = "";
+    for (const auto& [name, field] : fields()) {
+      file << separator << "\n    \"" << name << "\": {\"p50\": " << percentile(field, 50)
+           << ", \"p95\": " << percentile(field, 95) << ", \"p99\": " << percentile(field, 99) << "}";
+      separator = ",";
+    }
+    file << "\n  },\n  \"samples\": [";
+    separator = "";
+    for (size_t i = 0; i < count; i++) {
+      const FrameTimings& timings = at(i);
+      file << separator << "\n    {\"frame\": " << timings.frameNumber;
+      for (const auto& field : fields()) {
+        file << ", \"" << field.first << "\": " << timings.*field.second;
+      }
+      file << "}";
+      separator = ",";
+    }
+    file << "\n  ]\n}\n";
+  }
+
+private:
+  std::vector<FrameTimings> frames; // Ring buffer of frames
+  size_t next = 0; // Slot the next frame is written to
+  size_t count = 0; // Valid frames in the ring buffer
+  std::map<std::string, double> metrics;
+
+  // Reported timings and their names
+  static const std::vector<std::pair<const char*, double FrameTimings::*>>& fields() {
+    static const std::vector<std::pair<const char*, double FrameTimings::*>> list = {
+      {"frame_ms", &FrameTimings::frameMs},
+      {"gpu_ms", &FrameTimings::gpuMs},
+      {"wait_ms", &FrameTimings::waitMs},
+      {"acquire_ms", &FrameTimings::acquireMs},
+      {"update_ms", &FrameTimings::updateMs},
+      {"record_ms", &FrameTimings::recordMs},
+      {"submit_ms", &FrameTimings::submitMs},
+      {"present_ms", &FrameTimings::presentMs},
+    };
+    return list;
+  }
+
+  // i-th oldest frame in the ring buffer
+  const FrameTimings& at(size_t i) const {
+    return frames[(next + frames.size() - count + i) % frames.size()];
+  }
+
+  // Known values of a timing, skipping GPU times that never arrived
+  std::vector<double> collect(double FrameTimings::*field) const {
+    std::vector<double> values;
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      double value = at(i).*field;
+      if (value >= 0.0) {
+        values.push_back(value);
+      }
+    }
+    return values;
+  }
+};
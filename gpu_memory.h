@@ -0,0 +1,491 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+// Default size of the vkAllocateMemory blocks resources are carved out of
+const VkDeviceSize DEFAULT_MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Rounds value up to a multiple of alignment, alignment being a power of two
+inline VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// A range of device memory handed out by GpuAllocator
+struct GpuAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE; // Block the range lives in
+  VkDeviceSize offset = 0; // Offset of the range in the block, to pass to vkBind*Memory
+  VkDeviceSize size = 0; // Size of the range, including alignment padding
+  void* mapped = nullptr; // Host pointer to the range, only set for host visible memory
+  uint32_t blockIndex = 0; // Block the range belongs to, used when freeing
+};
+
+// Whether a resource is laid out linearly (buffers) or not (optimal tiling images),
+//  as the two must not share a bufferImageGranularity page
+enum class GpuResourceKind { Linear, Optimal };
+
+// Sub-allocates resources out of a few large vkAllocateMemory blocks per memory
+//  type, since drivers limit the amount of allocations (maxMemoryAllocationCount)
+//  and each allocation is expensive. Free ranges are tracked per block and
+//  coalesced on free. Host visible blocks stay mapped for their whole lifetime.
+class GpuAllocator {
+public:
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = DEFAULT_MEMORY_BLOCK_SIZE) {
+    this->device = device;
+    this->blockSize = blockSize;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+  }
+
+  // Frees every block, all allocations must have been freed or be unused by now
+  void destroy() {
+    for (Block& block : blocks) {
+      if (block.memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, block.memory, nullptr);
+      }
+    }
+    blocks.clear();
+  }
+
+  // Finds a memory type allowed by typeFilter that has all the requested properties
+  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+      if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+        return i;
+      }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+  }
+
+  GpuAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, GpuResourceKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+    // Optimal images are padded out to whole granularity pages on both ends,
+    //  so a buffer never shares a page with them
+    VkDeviceSize alignment = requirements.alignment;
+    VkDeviceSize size = requirements.size;
+    if (kind == GpuResourceKind::Optimal) {
+      alignment = std::max(alignment, bufferImageGranularity);
+      size = alignUp(size, bufferImageGranularity);
+    }
+
+    // Large resources get a block of their own instead of fragmenting the shared ones
+    if (size > blockSize / 2) {
+      uint32_t blockIndex = createBlock(memoryType, size);
+      Block& block = blocks[blockIndex];
+      block.dedicated = true;
+      block.freeRanges.clear();
+      return makeAllocation(blockIndex, 0, size);
+    }
+
+    // First fit over the existing blocks of this memory type
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+      if (blocks[i].memory == VK_NULL_HANDLE || blocks[i].memoryType != memoryType) {continue;}
+
+      VkDeviceSize offset;
+      if (takeRange(blocks[i], size, alignment, offset)) {
+        return makeAllocation(i, offset, size);
+      }
+    }
+
+    // Nothing fits, so open a new block
+    uint32_t blockIndex = createBlock(memoryType, blockSize);
+    VkDeviceSize offset;
+    takeRange(blocks[blockIndex], size, alignment, offset);
+    return makeAllocation(blockIndex, offset, size);
+  }
+
+  // Returns the range to its block. Dedicated blocks are released right away,
+  //  shared ones are kept around for later allocations
+  void free(GpuAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {return;}
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Block& block = blocks[allocation.blockIndex];
+    auto next = block.freeRanges.emplace(allocation.offset, allocation.size).first;
+
+    // Merge with the following free range
+    auto after = std::next(next);
+    if (after != block.freeRanges.end() && next->first + next->second == after->first) {
+      next->second += after->second;
+      block.freeRanges.erase(after);
+    }
+    // Merge with the preceding free range
+    if (next != block.freeRanges.begin()) {
+      auto before = std::prev(next);
+      if (before->first + before->second == next->first) {
+        before->second += next->second;
+        block.freeRanges.erase(next);
+      }
+    }
+
+    block.allocationCount--;
+    if (block.allocationCount == 0 && block.dedicated) {
+      vkFreeMemory(device, block.memory, nullptr);
+      block = Block{};
+    }
+
+    allocation = GpuAllocation{};
+  }
+
+  // Amount of live vkAllocateMemory blocks, for comparing against the allocation count
+  uint32_t blockCount() const {
+    uint32_t count = 0;
+    for (const Block& block : blocks) {
+      if (block.memory != VK_NULL_HANDLE) {count++;}
+    }
+    return count;
+  }
+
+private:
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryType = 0;
+    void* mapped = nullptr; // Whole block mapping for host visible memory
+    uint32_t allocationCount = 0;
+    bool dedicated = false; // Holds a single large resource
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges; // Free ranges by offset, to their size
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkDeviceSize blockSize = DEFAULT_MEMORY_BLOCK_SIZE;
+  VkDeviceSize bufferImageGranularity = 1;
+  VkPhysicalDeviceMemoryProperties memProperties{};
+  std::vector<Block> blocks; // Freed blocks are left empty and reused
+  std::mutex mutex;
+
+  uint32_t createBlock(uint32_t memoryType, VkDeviceSize size) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    Block block;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate device memory block!");
+    }
+    block.size = size;
+    block.memoryType = memoryType;
+    block.freeRanges.emplace(0, size);
+
+    // Keep host visible blocks mapped, mapping per upload is needlessly slow
+    if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS) {
+        vkFreeMemory(device, block.memory, nullptr);
+        throw std::runtime_error("failed to map device memory block!");
+      }
+    }
+
+    // Reuse the slot of a released block if there is one
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+      if (blocks[i].memory == VK_NULL_HANDLE) {
+        blocks[i] = std::move(block);
+        return i;
+      }
+    }
+    blocks.push_back(std::move(block));
+    return static_cast<uint32_t>(blocks.size() - 1);
+  }
+
+  // Takes an aligned range out of the first free range it fits in
+  bool takeRange(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+      VkDeviceSize rangeStart = it->first;
+      VkDeviceSize rangeEnd = it->first + it->second;
+      VkDeviceSize alignedStart = alignUp(rangeStart, alignment);
+      if (alignedStart + size > rangeEnd) {continue;}
+
+      // Give back what is left on either side of the taken range
+      block.freeRanges.erase(it);
+      if (alignedStart > rangeStart) {
+        block.freeRanges.emplace(rangeStart, alignedStart - rangeStart);
+      }
+      if (alignedStart + size < rangeEnd) {
+        block.freeRanges.emplace(alignedStart + size, rangeEnd - (alignedStart + size));
+      }
+
+      offset = alignedStart;
+      return true;
+    }
+    return false;
+  }
+
+  GpuAllocation makeAllocation(uint32_t blockIndex, VkDeviceSize offset, VkDeviceSize size) {
+    Block& block = blocks[blockIndex];
+    block.allocationCount++;
+
+    GpuAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.blockIndex = blockIndex;
+    if (block.mapped != nullptr) {
+      allocation.mapped = static_cast<char*>(block.mapped) + offset;
+    }
+    return allocation;
+  }
+};
+
+// Bookkeeping of a ring buffer whose space is handed out in order and given
+//  back oldest first, once whatever read it has finished. The owner tracks
+//  those readers and passes idle when there are none left, as an empty ring
+//  and a full one both have head == tail
+class RingSpace {
+public:
+  void init(VkDeviceSize capacity) {
+    this->capacity = capacity;
+    head = tail = 0;
+  }
+
+  VkDeviceSize size() const {return capacity;}
+
+  // Offset of size free bytes at alignment, or nothing while the ring is too full
+  std::optional<VkDeviceSize> reserve(VkDeviceSize size, VkDeviceSize alignment, bool idle) {
+    if (idle) {
+      head = tail = 0;
+    }
+
+    std::optional<VkDeviceSize> offset;
+    VkDeviceSize alignedHead = alignUp(head, alignment);
+    if (idle || head > tail) {
+      // Live space is [tail, head), use the space behind head or wrap around to the front
+      if (alignedHead + size <= capacity) {
+        offset = alignedHead;
+      } else if (size <= tail) {
+        offset = 0;
+      }
+    } else if (head < tail && alignedHead + size <= tail) {
+      // Live space wraps around, only the gap up to tail is free
+      offset = alignedHead;
+    }
+
+    if (offset) {
+      head = *offset + size;
+    }
+    return offset;
+  }
+
+  // End of the space reserved so far, which release(end) gives back
+  VkDeviceSize end() const {return head;}
+
+  // Gives back everything reserved before end() returned end
+  void release(VkDeviceSize end) {tail = end;}
+
+private:
+  VkDeviceSize capacity = 0;
+  VkDeviceSize head = 0; // Where the next reservation starts
+  VkDeviceSize tail = 0; // Start of the oldest space still read
+};
+
+// Host visible ring buffer that uploads go through on their way to device local
+//  memory. Copies are batched into one command buffer until flush(), and ring
+//  space is only reused once the submission that read it has finished, so
+//  uploading never waits on the GPU unless the ring is full.
+class StagingRing {
+public:
+  void init(VkDevice device, GpuAllocator& allocator, VkQueue queue, uint32_t queueFamily, VkDeviceSize capacity) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->queue = queue;
+    space.init(capacity);
+
+    // Persistently mapped staging buffer
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create staging buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    allocation = allocator.allocate(memRequirements,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, GpuResourceKind::Linear);
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+    // Transient pool, copy command buffers are short lived and reset individually
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create staging command pool!");
+    }
+  }
+
+  void destroy() {
+    waitIdle();
+
+    for (const Submission& submission : freeSubmissions) {
+      vkDestroyFence(device, submission.fence, nullptr);
+    }
+    freeSubmissions.clear();
+    vkDestroyCommandPool(device, commandPool, nullptr);
+
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(allocation);
+  }
+
+  // Queues a copy of data into dst at dstOffset, splitting uploads larger than the ring
+  void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      VkDeviceSize chunkSize = std::min(size, space.size());
+      VkDeviceSize srcOffset = reserve(chunkSize, 4);
+      memcpy(static_cast<char*>(allocation.mapped) + srcOffset, bytes, chunkSize);
+
+      VkBufferCopy copyRegion{};
+      copyRegion.srcOffset = srcOffset;
+      copyRegion.dstOffset = dstOffset;
+      copyRegion.size = chunkSize;
+      vkCmdCopyBuffer(pending.commandBuffer, buffer, dst, 1, &copyRegion);
+
+      bytes += chunkSize;
+      dstOffset += chunkSize;
+      size -= chunkSize;
+    }
+  }
+
+  // Submits the queued copies without waiting for them. A barrier at the end
+  //  makes the copies visible to every command submitted afterwards
+  void flush() {
+    if (pending.commandBuffer == VK_NULL_HANDLE) {return;}
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(pending.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    if (vkEndCommandBuffer(pending.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record staging command buffer!");
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &pending.commandBuffer;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, pending.fence) != VK_SUCCESS) {
+      throw std::runtime_error("failed to submit staging command buffer!");
+    }
+
+    pending.end = space.end();
+    inFlight.push_back(pending);
+    pending = Submission{};
+  }
+
+  // Flushes and waits for every upload to finish
+  void waitIdle() {
+    flush();
+    while (!inFlight.empty()) {
+      retireOldest();
+    }
+  }
+
+private:
+  // A batch of copies and the end of the ring space it reads
+  struct Submission {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkDeviceSize end = 0;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  GpuAllocator* allocator = nullptr;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  GpuAllocation allocation;
+  RingSpace space; // Of buffer, reserved by uploads and released as batches finish
+  Submission pending; // Copies recorded since the last flush
+  std::deque<Submission> inFlight; // Submitted batches, oldest first
+  std::vector<Submission> freeSubmissions; // Finished command buffers and fences ready for reuse
+
+  bool empty() const {
+    return inFlight.empty() && pending.commandBuffer == VK_NULL_HANDLE;
+  }
+
+  // Finds ring space for size bytes, waiting for old batches to finish when full
+  VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment) {
+    while (true) {
+      if (std::optional<VkDeviceSize> offset = space.reserve(size, alignment, empty())) {
+        beginPending();
+        return *offset;
+      }
+
+      // Full, make room by waiting for the oldest batch
+      if (inFlight.empty()) {
+        flush();
+      }
+      retireOldest();
+    }
+  }
+
+  // Starts recording a new batch if none is open
+  void beginPending() {
+    if (pending.commandBuffer != VK_NULL_HANDLE) {return;}
+
+    if (!freeSubmissions.empty()) {
+      pending = freeSubmissions.back();
+      freeSubmissions.pop_back();
+      vkResetCommandBuffer(pending.commandBuffer, 0);
+      vkResetFences(device, 1, &pending.fence);
+    } else {
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = commandPool;
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocInfo.commandBufferCount = 1;
+
+      VkFenceCreateInfo fenceInfo{};
+      fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+      if (vkAllocateCommandBuffers(device, &allocInfo, &pending.commandBuffer) != VK_SUCCESS ||
+          vkCreateFence(device, &fenceInfo, nullptr, &pending.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create staging submission!");
+      }
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(pending.commandBuffer, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin staging command buffer!");
+    }
+  }
+
+  // Waits for the oldest batch and releases the ring space it read
+  void retireOldest() {
+    Submission submission = inFlight.front();
+    inFlight.pop_front();
+
+    vkWaitForFences(device, 1, &submission.fence, VK_TRUE, UINT64_MAX);
+    space.release(submission.end);
+    freeSubmissions.push_back(submission);
+  }
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the jobs started with it that haven't finished yet. Work depending
+//  on those jobs waits on the counter with JobSystem::wait, which is how
+//  jobs depend on each other: a job needing the results of others waits on
+//  their counter, running other jobs in the meantime. Must outlive its jobs
+class JobCounter {
+public:
+  JobCounter() = default;
+  JobCounter(const JobCounter&) = delete;
+  JobCounter& operator=(const JobCounter&) = delete;
+
+  bool done() const {return pending.load(std::memory_order_acquire) == 0;}
+
+private:
+  friend class JobSystem;
+
+  std::atomic<uint32_t> pending{0};
+  std::atomic<bool> failed{false}; // Set by the first job throwing, which stores its exception
+  std::exception_ptr error;
+};
+
+// Work stealing scheduler running jobs on a fixed set of worker threads.
+//  Every worker has its own queue, pushing and popping jobs at its back so
+//  the job it just spawned, whose data is still in its cache, runs next.
+//  Workers out of jobs steal from the front of the other queues, taking the
+//  oldest jobs, which tend to be the biggest. Threads that aren't workers,
+//  such as the main thread, push into a queue of their own, and run jobs
+//  too while they wait on a counter, so no thread blocks while there is work.
+//  Jobs are a function pointer and a range, started without a heap
+//  allocation by parallelFor, so the per frame work can use them
+class JobSystem {
+public:
+  // workerCount may be 0, every job then runs on the thread waiting for it
+  explicit JobSystem(uint32_t workerCount) : queues(workerCount + 1) {
+    threads.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++) {
+      threads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+  }
+
+  // Jobs still queued are run first, their counters have to be alive
+  ~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  uint32_t workerCount() const {return static_cast<uint32_t>(threads.size());}
+
+  // Starts job, any callable without arguments, counting it on counter.
+  //  The callable is moved to the heap, so this is for the coarse jobs of
+  //  initialization rather than the per frame ones
+  template <typename Function>
+  void run(Function&& function, JobCounter& counter) {
+    using Callable = std::decay_t<Function>;
+    Job job{};
+    job.function = [](void* data, size_t, size_t) {
+      std::unique_ptr<Callable> callable(static_cast<Callable*>(data));
+      (*callable)();
+    };
+    job.data = new Callable(std::forward<Function>(function));
+    job.counter = &counter;
+    push(job);
+  }
+
+  // Calls function(begin, end) over [0, count) in ranges of at most grain,
+  //  counting the ranges on counter. function is referenced by the jobs, not
+  //  copied, so it must stay alive until counter is waited on. Counts
+  //  fitting a single range are run right away on the calling thread
+  template <typename Function>
+  void parallelFor(size_t count, size_t grain, Function& function, JobCounter& counter) {
+    grain = std::max<size_t>(grain, 1);
+    if (count <= grain) {
+      if (count > 0) {
+        function(size_t(0), count);
+      }
+      return;
+    }
+
+    for (size_t begin = 0; begin < count; begin += grain) {
+      Job job{};
+      job.function = [](void* data, size_t rangeBegin, size_t rangeEnd) {
+        (*static_cast<Function*>(data))(rangeBegin, rangeEnd);
+      };
+      job.data = &function;
+      job.begin = begin;
+      job.end = std::min(begin + grain, count);
+      job.counter = &counter;
+      push(job);
+    }
+  }
+
+  // Runs jobs until every job counted on counter finished, then rethrows
+  //  the first exception one of them threw
+  void wait(JobCounter& counter) {
+    while (!counter.done()) {
+      if (!runOne(queueIndex())) {
+        std::this_thread::yield(); // The rest is running on other threads
+      }
+    }
+
+    if (counter.failed.load(std::memory_order_acquire)) {
+      std::exception_ptr error = counter.error;
+      counter.error = nullptr;
+      counter.failed.store(false, std::memory_order_relaxed);
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+  struct Job {
+    void (*function)(void* data, size_t begin, size_t end);
+    void* data;
+    size_t begin;
+    size_t end;
+    JobCounter* counter;
+  };
+
+  // Ring buffer of jobs that doubles when full and never shrinks, so once
+  //  it has grown to what a frame spawns pushing allocates nothing
+  struct Queue {
+    std::mutex mutex;
+    std::vector<Job> jobs;
+    size_t head = 0; // Oldest job, taken by thieves
+    size_t size = 0;
+
+    void pushBack(const Job& job) {
+      if (size == jobs.size()) {
+        std::vector<Job> grown(std::max<size_t>(jobs.size() * 2, 64));
+        for (size_t i = 0; i < size; i++) {
+          grown[i] = jobs[(head + i) % jobs.size()];
+        }
+        jobs.swap(grown);
+        head = 0;
+      }
+      jobs[(head + size) % jobs.size()] = job;
+      size++;
+    }
+
+    bool popBack(Job& job) {
+      if (size == 0) {return false;}
+      size--;
+      job = jobs[(head + size) % jobs.size()];
+      return true;
+    }
+
+    bool popFront(Job& job) {
+      if (size == 0) {return false;}
+      job = jobs[head];
+      head = (head + 1) % jobs.size();
+      size--;
+      return true;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<Queue> queues; // One per worker, then the one shared by every other thread
+
+  std::mutex wakeMutex;
+  std::condition_variable wake; // Signals idle workers a new job or shutdown
+  std::atomic<uint32_t> queuedJobs{0}; // Jobs pushed and not yet taken by any thread
+  bool stopping = false;
+
+  // Which worker of which job system the calling thread is, if any
+  inline static thread_local JobSystem* workerSystem = nullptr;
+  inline static thread_local uint32_t workerIndex = 0;
+
+  uint32_t queueIndex() const {
+    return workerSystem == this ? workerIndex : workerCount();
+  }
+
+  void push(const Job& job) {
+    job.counter->pending.fetch_add(1, std::memory_order_relaxed);
+    Queue& queue = queues[queueIndex()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.pushBack(job);
+    }
+    queuedJobs.fetch_add(1, std::memory_order_release);
+
+    // Taking the lock orders this with a worker checking queuedJobs before it sleeps
+    {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wake.notify_one();
+  }
+
+  // Runs a job from queue own, or stolen from another queue, and returns
+  //  whether there was one
+  bool runOne(uint32_t own) {
+    Job job;
+    bool found;
+    {
+      std::lock_guard<std::mutex> lock(queues[own].mutex);
+      found = queues[own].popBack(job);
+    }
+    for (uint32_t i = 1; !found && i < queues.size(); i++) {
+      Queue& victim = queues[(own + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      found = victim.popFront(job);
+    }
+    if (!found) {
+      return false;
+    }
+    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+
+    JobCounter& counter = *job.counter;
+    try {
+      job.function(job.data, job.begin, job.end);
+    } catch (...) {
+      if (!counter.failed.exchange(true, std::memory_order_acq_rel)) {
+        counter.error = std::current_exception();
+      }
+    }
+    // Last touch of the counter, its owner may destroy it right after
+    counter.pending.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+  }
+
+  void workerLoop(uint32_t index) {
+    workerSystem = this;
+    workerIndex = index;
+
+    while (true) {
+      if (runOne(index)) {
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      wake.wait(lock, [this] {return stopping || queuedJobs.load(std::memory_order_acquire) > 0;});
+      if (stopping && queuedJobs.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+    }
+  }
+};
+
+// Waits on counters when it goes out of scope, so an exception thrown while
+//  their jobs are still running can't unwind the counters, or whatever the
+//  jobs write to, from under them. Errors of those jobs are dropped, the
+//  exception already unwinding is the one reported
+class JobWaitGuard {
+public:
+  JobWaitGuard(JobSystem& jobs, std::initializer_list<JobCounter*> counters) : jobs(jobs), counters(counters) {}
+
+  ~JobWaitGuard() {
+    for (JobCounter* counter : counters) {
+      try {
+        jobs.wait(*counter);
+      } catch (...) {
+      }
+    }
+  }
+
+  JobWaitGuard(const JobWaitGuard&) = delete;
+  JobWaitGuard& operator=(const JobWaitGuard&) = delete;
+
+private:
+  JobSystem& jobs;
+  std::vector<JobCounter*> counters;
+};
@@ -16,11 +16,132 @@
 #include <set>
 #include <limits> // Necessary for std::numeric_limits
 #include <algorithm> // Necessary for std::clamp
+#include <string>
+#include <array>
+#include <cstddef> // Necessary for offsetof
+#include <chrono> // Necessary for timing pipeline creation
+#include <cstdio> // Necessary for std::rename
+#include <memory>
+#include <mutex>
+#include <cmath> // Necessary for animating instances
+#include <new> // Necessary for replacing operator new
+#include <future> // Necessary for comparing jobs against std::async
+
+#include "frame_stats.h"
+#include "gpu_memory.h"
+#include "job_system.h"
+#include "async_upload.h"
+#include "shader_loader.h"
+#include "pipeline_registry.h"
+#include "device_handle.h"
+#include "deletion_queue.h"
+#include "shader_watcher.h"
+#include "uniform_ring.h"
+#include "descriptor_allocator.h"
+#include "texture.h"
+#include "draw_sort.h"
+#include "render_graph.h"
+#include "bindless.h"
+#include "device_features.h"
+#include "frame_arena.h"
+
+// Built with `make embedded`, the shaders are compiled into the binary
+#ifdef EMBED_SHADERS
+#include "shaders/embedded_shaders.h"
+#endif
+
+// Counts every heap allocation into heapAllocationCount, reported as
+//  steady_state_allocations. libstdc++ forwards the array and nothrow forms
+//  of operator new to these two, plain and over-aligned. Like the default
+//  ones, they call the new handler until it frees enough memory or throws
+void* operator new(size_t size) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  size = size == 0 ? 1 : size;
+  while (true) {
+    if (void* memory = std::malloc(size)) {
+      return memory;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  // aligned_alloc takes sizes that are a multiple of the alignment only
+  size_t align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+  size = (std::max<size_t>(size, 1) + align - 1) & ~(align - 1);
+  while (true) {
+    if (void* memory = std::aligned_alloc(align, size)) {
+      return memory;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+  std::free(memory);
+}
 
 // Window WIDTH and HEIGHT
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
+// Format of the images rendered into when running headless
+const VkFormat HEADLESS_IMAGE_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+// Size of the ring buffer uploads are staged through
+const VkDeviceSize STAGING_RING_SIZE = 8 * 1024 * 1024;
+
+// Width and height of the quads' texture
+const uint32_t TEXTURE_SIZE = 256;
+
+// Frames rendered per instance count by --benchmark-instances
+const uint32_t BENCHMARK_INSTANCE_FRAMES = 200;
+
+// Frames recorded per thread count by --benchmark-recording
+const uint32_t BENCHMARK_RECORD_ITERATIONS = 200;
+
+// Times the swap chain's framebuffers and attachments are rebuilt per path by --benchmark-rendering
+const uint32_t BENCHMARK_RECREATE_ITERATIONS = 100;
+
+// Jobs started per round, and rounds, by --benchmark-jobs
+const uint32_t BENCHMARK_JOB_COUNT = 1000;
+const uint32_t BENCHMARK_JOB_ROUNDS = 20;
+
+// Instances one job animates or lays out. Fewer than this run inline,
+//  splitting them wouldn't pay for starting the jobs
+const size_t INSTANCE_JOB_GRAIN = 16384;
+
+// Frames after which textures are uploaded and every arena, pool and list
+//  has grown to its steady state size, later frames shouldn't allocate
+const uint64_t ALLOCATION_WARMUP_FRAMES = 16;
+
+// Default file the pipeline cache is loaded from and saved to
+const char* DEFAULT_PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// Default amount of frames the CPU may record ahead of the GPU
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
 // Lists validationLayers
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -56,10 +177,178 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
     }
 }
 
+// Plain vector types for vertex data
+struct Vec2 {
+  float x, y;
+};
+
+struct Vec3 {
+  float x, y, z;
+};
+
+// Layout of a single vertex in the vertex buffer
+struct Vertex {
+  Vec2 pos;
+  Vec3 color;
+
+  // Vertices are tightly packed in binding 0, one per vertex
+  static VkVertexInputBindingDescription getBindingDescription() {
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(Vertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+  }
+
+  // One attribute per member, matching the locations in shader.vert
+  static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+    std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+    return attributeDescriptions;
+  }
+};
+
+// Quad drawn by the application, as two indexed triangles
+const std::vector<Vertex> vertices = {
+  {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+  {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+  {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+  {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}
+};
+
+const std::vector<uint16_t> indices = {
+  0, 1, 2, 2, 3, 0
+};
+
+// Per instance data as one array per attribute (structure of arrays),
+//  so the per frame update only streams through the attributes it changes
+struct InstanceStreams {
+  std::vector<Vec2> basePositions; // Grid position the animated offset moves around
+  std::vector<float> phases; // Animation phase
+  std::vector<float> scales;
+  std::vector<uint32_t> colors; // Packed RGBA8
+
+  size_t size() const {return basePositions.size();}
+
+  // The streams the vertex shader reads, each in its own binding advancing once per instance
+  static std::array<VkVertexInputBindingDescription, 3> getBindingDescriptions() {
+    std::array<VkVertexInputBindingDescription, 3> bindingDescriptions{};
+
+    bindingDescriptions[0].binding = 1;
+    bindingDescriptions[0].stride = sizeof(Vec2); // Animated offset
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    bindingDescriptions[1].binding = 2;
+    bindingDescriptions[1].stride = sizeof(float); // Scale
+    bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    bindingDescriptions[2].binding = 3;
+    bindingDescriptions[2].stride = sizeof(uint32_t); // Color
+    bindingDescriptions[2].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    return bindingDescriptions;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+
+    attributeDescriptions[0].binding = 1;
+    attributeDescriptions[0].location = 2;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = 0;
+
+    attributeDescriptions[1].binding = 2;
+    attributeDescriptions[1].location = 3;
+    attributeDescriptions[1].format = VK_FORMAT_R32_SFLOAT;
+    attributeDescriptions[1].offset = 0;
+
+    attributeDescriptions[2].binding = 3;
+    attributeDescriptions[2].location = 4;
+    attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+    attributeDescriptions[2].offset = 0;
+
+    return attributeDescriptions;
+  }
+
+  // Where each stream starts in an instance buffer holding count instances
+  static std::array<VkDeviceSize, 3> getStreamOffsets(size_t count) {
+    VkDeviceSize offsetsStart = 0;
+    VkDeviceSize scalesStart = offsetsStart + count * sizeof(Vec2);
+    VkDeviceSize colorsStart = scalesStart + count * sizeof(float);
+    return {offsetsStart, scalesStart, colorsStart};
+  }
+
+  static VkDeviceSize getBufferSize(size_t count) {
+    return count * (sizeof(Vec2) + sizeof(float) + sizeof(uint32_t));
+  }
+};
+
+// Per draw transform applied on top of the instance's, pushed as push
+//  constants before every draw, laid out as in shader.vert
+struct DrawPushConstants {
+  Vec2 offset;
+  float scale;
+  float depth; // 0 is nearest, 1 farthest
+  uint32_t textureIndex; // Bindless slot of the texture sampled, unused when binding a texture set
+};
+
+// A single indexed, instanced draw of the draw list
+struct DrawCommand {
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t instanceCount;
+  uint32_t firstInstance;
+  uint32_t texture; // TextureId sampled, its bindless slot goes into constants
+  DrawPushConstants constants;
+};
+
+// Per frame data read by the shaders, allocated from the uniform ring every
+//  frame, laid out as in shader.vert
+struct FrameUniforms {
+  float viewProjection[16]; // Column major, instances are in clip space while it is the identity
+  float time; // Seconds of animation
+  float padding[3];
+};
+
+// Bounding sphere and draw parameters of an object, laid out as in cull.comp
+struct CullObject {
+  float sphere[4]; // Center relative to the object's instance offset in xyz, radius in w
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t padding;
+};
+
+// Push constants of cull.comp
+struct CullPushConstants {
+  float planes[6][4]; // Frustum planes, inward facing normal in xyz and distance in w
+  uint32_t objectCount;
+};
+
+// Command pool and secondary command buffer of one slice of the draw list
+//  for one frame in flight, recorded by one job at a time
+struct RecordingContext {
+  VkCommandPool commandPool;
+  VkCommandBuffer commandBuffer;
+};
+
 // Helper struct to manage graphicsFamily indices
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  std::optional<uint32_t> transferFamily; // Transfer capable family without graphics, if there is one
 
   bool isComplete() {
     return graphicsFamily.has_value() && presentFamily.has_value();
@@ -73,18 +362,76 @@ struct SwapChainSupportDetails {
   std::vector<VkPresentModeKHR> presentModes;
 };
 
+// Helper struct to hold the options parsed from the command line
+struct AppOptions {
+  uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT; // Frames recorded while the GPU works on earlier ones
+  bool headless = false; // Render into offscreen images without a window, surface or swapchain
+  uint32_t maxFrames = 0; // Frames to render before exiting, 0 renders until the window is closed
+  std::string outputPath; // PPM file the last headless frame is written to, empty for none
+  std::string pipelineCachePath = DEFAULT_PIPELINE_CACHE_PATH; // Pipeline cache file, empty to disable
+  std::string statsCsvPath; // File per frame timings are written to as CSV, empty for none
+  std::string statsJsonPath; // File frame timing percentiles and samples are written to as JSON, empty for none
+  uint32_t instanceCount = 1; // Quads drawn, raised to drawCount if lower
+  uint32_t drawCount = 1; // Draws the instances are split over, to load the command buffer recording
+  uint32_t recordThreads = 0; // Secondary command buffers the draws are split over and recorded by jobs, 0 records inline on the main thread
+  bool benchmarkRecording = false; // Time recording with increasing secondary command buffer counts instead of rendering
+  bool benchmarkInstances = false; // Time frames with increasing instance counts instead of rendering
+  bool gpuCulling = false; // Cull instances in a compute shader and draw the survivors indirectly
+  bool benchmarkPipelines = false; // Time compiling a set of pipeline permutations instead of rendering
+  uint32_t pipelineThreads = 0; // Threads compiling pipelines, 0 uses the job system's
+  bool watchShaders = false; // Recompile the shaders when they are saved and swap in the new pipeline
+  bool streamTextures = false; // Upload textures smallest mip first over several frames instead of blitting their mips
+  bool dynamicRendering = false; // Render with vkCmdBeginRendering instead of render pass and framebuffer objects
+  bool benchmarkRendering = false; // Time rebuilding the swap chain's targets and recording with both render paths instead of rendering
+  bool bindless = false; // Sample textures by index out of one descriptor set instead of binding a set per frame
+  uint32_t jobThreads = 0; // Job system workers besides the main thread, 0 uses every other hardware thread
+  bool benchmarkJobs = false; // Time starting and waiting on jobs against std::async instead of rendering
+};
+
 // Application Class
 class HelloTriangleApplication {
 public:
+  HelloTriangleApplication(const AppOptions& options) : options(options) {}
+
   // Main function to run applciation
   void run() {
-    initWindow();
-    initVulkan();
-    mainLoop();
+    // Startup as the benchmark harness sees it, from nothing to ready to render
+    double startupMs = 0.0;
+    {
+      ScopedTimer timer(startupMs);
+      initWindow();
+      initVulkan();
+    }
+    frameStats.setMetric("startup_ms", startupMs);
+    frameStats.setMetric("triangles_per_frame", static_cast<double>(instances.size() * indices.size() / 3));
+    if (options.benchmarkRecording) {
+      benchmarkRecording();
+    } else if (options.benchmarkInstances) {
+      benchmarkInstances();
+    } else if (options.benchmarkPipelines) {
+      benchmarkPipelines();
+    } else if (options.benchmarkRendering) {
+      benchmarkRendering();
+    } else if (options.benchmarkJobs) {
+      benchmarkJobs();
+    } else {
+      mainLoop();
+    }
     cleanup();
+
+    // Headless runs are what CI and the benchmarks run, a frame past the
+    //  warm up reaching the heap fails them instead of only being reported.
+    //  The shader watcher's thread allocates while frames run, which the
+    //  process wide count can't tell apart
+    if (options.headless && !options.watchShaders && steadyStateAllocations > 0) {
+      throw std::runtime_error(std::to_string(steadyStateAllocations) + " heap allocations by frames after the first " +
+          std::to_string(ALLOCATION_WARMUP_FRAMES) + ", steady state frames must not allocate!");
+    }
   }
 
 private:
+  AppOptions options; // Options given on the command line
+
   GLFWwindow* window; // window used by Vulkan
 
   VkInstance instance; // instance of Vulkan
@@ -92,38 +439,174 @@ private:
   VkSurfaceKHR surface; // Vulkan surface
 
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE; // Holds reference to physical device
+  DeviceCapabilities deviceCapabilities; // What physicalDevice supports and which of it device enables
   VkDevice device; // Holds logical device handle
 
   VkQueue graphicsQueue; // handle for graphics queue
   VkQueue presentQueue; // handle for present queue
+  VkQueue transferQueue; // handle for the queue async uploads run on
 
-  VkSwapchainKHR swapChain; // Holds swap chain handle
-  std::vector<VkImage> swapChainImages; // Holds swap chain images
+  SwapchainHandle swapChain; // Holds swap chain handle
+  bool framebufferResized = false; // Set by the resize callback, the swap chain is recreated on the next frame
+  uint32_t swapChainRecreations = 0;
+  std::vector<VkImage> swapChainImages; // Holds swap chain images, or the offscreen images when headless
+  std::vector<GpuAllocation> offscreenImageAllocations; // Backing memory of the headless offscreen images
   VkFormat swapChainImageFormat; // Format of swapchain Images
   VkExtent2D swapChainExtent; // Size details for swapchain images
-  std::vector<VkImageView> swapChainImageViews; // Stores image views
-
-  VkRenderPass renderPass;
-  VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
-
-  std::vector<VkFramebuffer> swapChainFramebuffers;
-
-  VkCommandPool commandPool;
-  VkCommandBuffer commandBuffer;
+  std::vector<ImageViewHandle> swapChainImageViews; // Stores image views
+
+  VkFormat depthFormat; // Best depth format the device supports as attachment
+
+  // Passes of a frame and the resources they use, recordCommandBuffer executes it
+  RenderGraph renderGraph;
+  RenderGraph::ResourceId colorTarget; // The swap chain image being rendered
+  RenderGraph::ResourceId depthTarget; // Transient depth buffer, shared by every framebuffer
+  RenderGraph::ResourceId indirectTarget; // This frame's indirect draws, with gpuCulling
+  RenderGraph::ResourceId indirectCountTarget; // This frame's indirect draw count, with gpuCulling
+  uint32_t recordingImageIndex = 0; // Swap chain image the frame being recorded renders into
+
+  RenderPassHandle renderPass; // Null with dynamic rendering
+
+  bool dynamicRenderingSupported = false; // Enabled on the device, through Vulkan 1.3 or VK_KHR_dynamic_rendering
+  bool dynamicRendering = false; // Requested and supported, no render pass or framebuffers are created
+  PFN_vkCmdBeginRendering cmdBeginRendering = nullptr;
+  PFN_vkCmdEndRendering cmdEndRendering = nullptr;
+  PipelineCacheHandle pipelineCache; // Pipeline cache persisted to options.pipelineCachePath
+  bool pipelineCacheLoaded = false; // Whether valid cache data was found on disk
+  ShaderModuleCache shaderModules; // Every distinct shader module, created once
+  PipelineRegistry pipelines; // Every graphics pipeline, built in parallel and deduplicated
+  PipelineLayoutHandle pipelineLayout;
+  PipelineDesc graphicsPipelineDesc; // Description graphicsPipeline was requested with
+  VkPipeline graphicsPipeline; // Owned by pipelines
+  PipelineRegistry::PipelineId graphicsPipelineId; // Groups draws in their sort keys
+
+  // Shader hot reload, only used with options.watchShaders
+  ShaderWatcher shaderWatcher; // Recompiles saved shaders and rebuilds the pipeline on its own thread
+  std::mutex buildMutex; // Held by the watcher thread while it builds against a render pass and layout
+  std::mutex reloadMutex; // Guards the members below, shared with the watcher thread
+  PipelineDesc reloadBaseDesc; // Description reloaded pipelines start from
+  PipelineHandle reloadedPipeline; // Built by the watcher thread, swapped in by the next frame
+  PipelineDesc reloadedDesc; // Description reloadedPipeline was built from
+  double reloadMs = 0.0; // Time loading the shaders and building reloadedPipeline took
+  uint32_t shaderReloads = 0;
+
+  std::vector<FramebufferHandle> swapChainFramebuffers;
+
+  DeletionQueue deletionQueue; // Objects replaced while frames in flight may still use them
+
+  GpuAllocator allocator; // Sub-allocates device memory for buffers and images
+  StagingRing stagingRing; // Uploads data into device local buffers on the graphics queue
+  bool asyncUploads = false; // Timeline semaphores are supported, so uploads go through uploader
+  AsyncUploader uploader; // Uploads on the transfer queue without stalling rendering
+  uint64_t uploadWaitValue = 0; // Uploader timeline value the frame being recorded waits on
+
+  VkBuffer vertexBuffer;
+  GpuAllocation vertexBufferAllocation;
+  VkBuffer indexBuffer;
+  GpuAllocation indexBufferAllocation;
+
+  CommandPoolHandle commandPool;
+  std::vector<VkCommandBuffer> commandBuffers; // One command buffer per frame in flight
+
+  InstanceStreams instances; // CPU side instance data
+  std::vector<VkBuffer> instanceBuffers; // One per frame in flight, holding the streams one after another
+  std::vector<GpuAllocation> instanceBufferAllocations;
+
+  std::vector<DrawCommand> drawList; // Draws recorded every frame
+
+  DescriptorLayoutCache descriptorLayouts; // Every descriptor set layout
+  DescriptorAllocator descriptorAllocator; // Sets living as long as the application
+  std::vector<DescriptorAllocator> frameDescriptorAllocators; // Sets recorded by one frame, reset when the frame in flight comes around
+  std::vector<FrameArena> frameArenas; // CPU side data built by one frame, reset when the frame in flight comes around
+  uint64_t steadyStateAllocations = 0; // Heap allocations by frames past ALLOCATION_WARMUP_FRAMES
+
+  VkBuffer uniformBuffer; // Backs uniformRing
+  GpuAllocation uniformBufferAllocation;
+  UniformRing uniformRing; // Per frame uniform data, one region per frame in flight
+  VkDescriptorSetLayout frameDescriptorSetLayout; // Owned by descriptorLayouts
+  VkDescriptorSet frameDescriptorSet; // Points at uniformBuffer, frames select their data with a dynamic offset
+  FrameUniforms frameUniforms{}; // Uniforms of the frame being recorded
+  uint32_t frameUniformOffset = 0; // Dynamic offset of frameUniforms in uniformBuffer
+
+  TextureManager textures; // Sampled textures and their uploads
+  TextureManager::TextureId fallbackTexture; // 1x1 white, sampled until quadTexture has a level uploaded
+  TextureManager::TextureId quadTexture; // Sampled by every quad
+  VkDescriptorSetLayout textureDescriptorSetLayout; // Owned by descriptorLayouts
+  VkDescriptorSet textureDescriptorSet; // Set 1 of the frame being recorded
+  uint32_t textureCompleteFrame = 0; // Frame quadTexture became fully resident in, 0 until then
+
+  // Texture a bindless slot was written with
+  struct BindlessTexture {
+    VkImageView view = VK_NULL_HANDLE; // None until the texture is resident
+    uint32_t slot = 0;
+  };
+
+  bool bindless = false; // Requested and supported, textures are sampled out of bindlessHeap
+  BindlessHeap bindlessHeap; // Set 1 of every frame when bindless
+  std::vector<BindlessTexture> bindlessTextures; // Indexed by TextureId
+
+  bool gpuCulling = false; // Requested and supported by the device
+  bool drawIndirectCountSupported = false; // VK_KHR_draw_indirect_count is enabled
+  PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+  VkDescriptorSetLayout cullDescriptorSetLayout; // Owned by descriptorLayouts
+  PipelineLayoutHandle cullPipelineLayout;
+  PipelineHandle cullPipeline;
+  uint32_t cullObjectCount = 0; // Objects culled and drawn each frame
+  VkBuffer objectBuffer; // CullObject per instance
+  GpuAllocation objectBufferAllocation;
+  std::vector<VkBuffer> indirectBuffers; // Draw commands of the visible objects, one per frame in flight
+  std::vector<GpuAllocation> indirectBufferAllocations;
+  std::vector<VkBuffer> indirectCountBuffers; // Amount of visible objects, one per frame in flight
+  std::vector<GpuAllocation> indirectCountBufferAllocations;
+  std::vector<std::vector<RecordingContext>> recordingContexts; // Indexed by frame in flight, then by slice, empty when recording inline
+
+  std::unique_ptr<JobSystem> jobs; // Runs the independent parts of initialization and of every frame
+
+  // Sync objects, one of each per frame in flight
+  std::vector<SemaphoreHandle> imageAvailableSemaphores; // Signaled when a swapchain image is ready to render to
+  // Signaled when rendering is done and the image can be presented. One per
+  //  swap chain image rather than per frame in flight, as presenting holds on
+  //  to it until the image is acquired again, which can be after this frame
+  //  in flight comes around
+  std::vector<SemaphoreHandle> renderFinishedSemaphores;
+  // Signaled when the GPU is done with a frame's command buffer. Plain handles,
+  //  as they are waited on as an array, and destroyed by cleanup
+  std::vector<VkFence> inFlightFences;
+  uint32_t currentFrame = 0; // Index of the frame in flight being recorded
+  uint32_t frameCount = 0; // Frames submitted so far
+  uint32_t lastImageIndex = 0; // Image the last submitted frame rendered to
+
+  // Frame timing instrumentation
+  static constexpr uint64_t NO_FRAME = ~0ULL;
+  FrameStats frameStats; // Ring buffer of recent frame timings
+  std::chrono::steady_clock::time_point lastFrameStart; // Start of the previous drawFrame
+  QueryPoolHandle timestampQueryPool; // Render pass begin/end timestamps per frame in flight
+  std::vector<uint64_t> timestampFrameNumbers; // Frame whose timestamps each frame in flight holds, or NO_FRAME
+  float timestampPeriod = 0.0f; // Nanoseconds per timestamp tick
+  uint64_t timestampMask = 0; // Valid bits of a timestamp
 
   // Create GLFW Window
   void initWindow() {
+    // No window is needed when rendering headless
+    if (options.headless) {return;}
+
     // Initialize GLFW
     glfwInit();
 
     // Set to not use OpenGL API, Vulkan will be used
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    // Resizability will be on the backburner for now
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
     // doniw eht etaerC
     window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    // Let the resize callback find the application
+    glfwSetWindowUserPointer(window, this);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+  }
+
+  // Not every driver reports VK_ERROR_OUT_OF_DATE_KHR after a resize,
+  //  so resizes are flagged here as well
+  static void framebufferResizeCallback(GLFWwindow* window, int /*width*/, int /*height*/) {
+    auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+    app->framebufferResized = true;
   }
   
   void initVulkan() {
@@ -132,44 +615,162 @@ private:
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    createAllocator();
+    createJobSystem();
+    // Loading the shaders and laying out the instances needs no other Vulkan
+    //  objects, so they run as jobs while the main thread creates those, and
+    //  are waited on right before their results are used
+    JobCounter shadersLoaded, instancesCreated, cullPipelineCreated;
+    JobWaitGuard initJobs(*jobs, {&shadersLoaded, &instancesCreated, &cullPipelineCreated});
+    loadShaders(shadersLoaded);
+    jobs->run([this] {createInstances(std::max(options.instanceCount, options.drawCount));}, instancesCreated);
+    // Headless rendering replaces the swap chain with offscreen images
+    if (options.headless) {
+      createOffscreenImages();
+    } else {
+      createSwapChain();
+    }
     createImageViews();
     createRenderPass();
+    createPipelineCache();
+    createDescriptorAllocators();
+    createFrameUniforms();
+    createTextures();
+    pipelines.init(device, pipelineCache);
+    jobs->wait(shadersLoaded);
+    // The culling pipeline compiles as a job at the same time as the graphics one
+    if (gpuCulling) {
+      createCullingPipelineLayout();
+      jobs->run([this] {createCullingPipeline();}, cullPipelineCreated);
+    }
     createGraphicsPipeline();
+    if (options.watchShaders) {
+      startShaderWatcher();
+    }
+    renderGraph.init(device, allocator, deletionQueue);
+    createRenderGraph();
     createFrameBuffers();
     createCommandPool();
+    createVertexBuffer();
+    createIndexBuffer();
+    // Kick off the uploads, frames submitted later on see their results
+    submitUploads();
     createCommandBuffers();
+    jobs->wait(instancesCreated);
+    createInstanceBuffers();
+    createDrawList();
+    jobs->wait(cullPipelineCreated);
+    if (gpuCulling) {
+      createCullingBuffers();
+    }
+    createRecordingContexts(options.recordThreads);
+    createSyncObjects();
+    createTimestampQueryPool();
   }
 
   void mainLoop() {
-    // Loops until GLFW calls that the window should close
-    while (!glfwWindowShouldClose(window)) {
-      glfwPollEvents();
+    // Loops until GLFW calls that the window should close,
+    //  or until the requested amount of frames has been rendered
+    while (options.maxFrames == 0 || frameCount < options.maxFrames) {
+      if (!options.headless) {
+        if (glfwWindowShouldClose(window)) {break;}
+        glfwPollEvents();
+      }
+      drawFrame();
+    }
+
+    // Wait for the last frames to finish before anything gets destroyed
+    vkDeviceWaitIdle(device);
+
+    // Write out the last frame if requested
+    if (!options.outputPath.empty()) {
+      saveImage(swapChainImages[lastImageIndex], options.outputPath);
     }
+
+    reportFrameStats();
   }
 
   void cleanup() {
-    // Destroy commandPool
-    vkDestroyCommandPool(device, commandPool, nullptr);
-    // Destroy Framebuffers
-    for (auto framebuffer : swapChainFramebuffers) {
-      vkDestroyFramebuffer(device, framebuffer, nullptr);
+    // Stop reloading shaders, a pipeline built but never swapped in was never used
+    shaderWatcher.stop();
+    reloadedPipeline.reset();
+
+    // The device is idle, so everything waiting on frames in flight can go
+    deletionQueue.flush();
+
+    // Destroy the culling pipeline and buffers
+    if (gpuCulling) {
+      destroyCullingBuffers();
     }
+    cullPipeline.reset();
+    cullPipelineLayout.reset();
 
-    // Destroy graphicsPipeline
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    // Destroy pipelineLayout
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    // Destroy the textures, their samplers and staging buffer
+    textures.destroy();
+
+    // Destroy the uniform ring and every descriptor pool
+    destroyBuffer(uniformBuffer, uniformBufferAllocation);
+    for (DescriptorAllocator& frameAllocator : frameDescriptorAllocators) {
+      frameAllocator.destroy();
+    }
+    descriptorAllocator.destroy();
+
+    // Destroy instance, vertex and index buffers
+    destroyInstanceBuffers();
+    destroyBuffer(indexBuffer, indexBufferAllocation);
+    destroyBuffer(vertexBuffer, vertexBufferAllocation);
+
+    // Destroy timestamp queries
+    timestampQueryPool.reset();
+
+    // Destroy sync objects
+    renderFinishedSemaphores.clear();
+    imageAvailableSemaphores.clear();
+    for (VkFence fence : inFlightFences) {
+      vkDestroyFence(device, fence, nullptr);
+    }
+
+    // Destroy the recording command pools and stop the job system, nothing runs on it anymore
+    destroyRecordingContexts();
+    jobs.reset();
+
+    // Destroy commandPool
+    commandPool.reset();
+    // Destroy Framebuffers and imageViews
+    cleanupSwapChain();
+    deletionQueue.flush();
+
+    // Destroy graphicsPipeline and any other pipelines in the registry
+    pipelines.destroy();
+    // Write the pipelineCache back to disk for the next launch, then destroy it
+    savePipelineCache();
+    pipelineCache.reset();
+    // Destroy pipelineLayout, then the descriptor set layouts it was made from,
+    //  the bindless one along with its set
+    pipelineLayout.reset();
+    descriptorLayouts.destroy();
+    bindlessHeap.destroy();
+    // Destroy the shader modules, every pipeline using them is gone
+    shaderModules.destroy();
     // Destroy renderPass
-    vkDestroyRenderPass(device, renderPass, nullptr);
+    renderPass.reset();
 
-    // Destroy imageViews
-    for (auto imageView : swapChainImageViews) {
-      vkDestroyImageView(device, imageView, nullptr);
+    // Destroy Swapchain, or the offscreen images standing in for it
+    if (options.headless) {
+      for (size_t i = 0; i < swapChainImages.size(); i++) {
+        vkDestroyImage(device, swapChainImages[i], nullptr);
+        allocator.free(offscreenImageAllocations[i]);
+      }
+    } else {
+      swapChain.reset();
     }
 
-    // Destroy Swapchain
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    // Release the uploaders and every memory block
+    if (asyncUploads) {
+      uploader.destroy();
+    }
+    stagingRing.destroy();
+    allocator.destroy();
 
     // Destroy logical device
     vkDestroyDevice(device, nullptr);
@@ -180,11 +781,16 @@ private:
     }
 
     // Destroy the Vulkan Surface
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!options.headless) {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
 
     // Destroy the Vulkan Instance
     vkDestroyInstance(instance, nullptr);
 
+    // Headless runs never created a window
+    if (options.headless) {return;}
+
     // Destroy window
     glfwDestroyWindow(window);
 
@@ -205,7 +811,7 @@ private:
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0); // Version count of Application
     appInfo.pEngineName = "No Engine"; // Engine Name of Application
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0); // Engine Version
-    appInfo.apiVersion = VK_API_VERSION_1_0; // Version of Vulkan API being used
+    appInfo.apiVersion = VK_API_VERSION_1_3; // Highest version of Vulkan API used, older devices still work without the features needing it
 
     // Fillout Creation Info for VkInstance
     VkInstanceCreateInfo createInfo{};
@@ -264,6 +870,9 @@ private:
   }
 
   void createSurface() {
+    // Nothing is presented when headless, so no surface is needed
+    if (options.headless) {return;}
+
     if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
         throw std::runtime_error("failed to create window surface!");
     }
@@ -304,6 +913,9 @@ private:
     // List createInfos for both graphics and present family
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    if (indices.transferFamily.has_value()) {
+      uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
 
     // Set queue priority (first)
     float queuePriority = 1.0f;
@@ -318,18 +930,57 @@ private:
       queueCreateInfos.push_back(queueCreateInfo);
     }
 
-    // Specify device features to be used, set to VK_FALSE for now
-    VkPhysicalDeviceFeatures deviceFeatures{};
+    // Enable the required extensions, then whatever the options asked for
+    //  that the device supports, and nothing else
+    deviceCapabilities.query(physicalDevice);
+    for (const char* extension : getRequiredDeviceExtensions()) {
+      deviceCapabilities.enableExtension(extension);
+    }
+    for (const FeatureRequest& request : requestedFeatures(physicalDevice)) {
+      // The count only matters to the commands multi draw indirect makes possible
+      if (request.feature == DeviceFeature::DrawIndirectCount && !deviceCapabilities.isEnabled(DeviceFeature::MultiDrawIndirect)) {
+        continue;
+      }
+      deviceCapabilities.enable(request.feature);
+    }
+
+    // Async uploads signal their completion with a timeline semaphore
+    asyncUploads = deviceCapabilities.isEnabled(DeviceFeature::TimelineSemaphore);
+
+    // GPU culling draws every visible object with its own indirect command,
+    //  which starts at the object's instance. The count buffer is optional,
+    //  without it every command gets drawn and culled ones draw nothing
+    if (options.gpuCulling) {
+      gpuCulling = deviceCapabilities.isEnabled(DeviceFeature::MultiDrawIndirect);
+      drawIndirectCountSupported = deviceCapabilities.isEnabled(DeviceFeature::DrawIndirectCount);
+      if (!gpuCulling) {
+        std::cerr << "GPU culling is not supported by this device, drawing from the CPU instead" << std::endl;
+      }
+    }
+
+    if (options.dynamicRendering || options.benchmarkRendering) {
+      dynamicRenderingSupported = deviceCapabilities.isEnabled(DeviceFeature::DynamicRendering);
+      if (!dynamicRenderingSupported) {
+        std::cerr << "dynamic rendering is not supported by this device, using render pass objects instead" << std::endl;
+      }
+    }
+
+    if (options.bindless) {
+      bindless = deviceCapabilities.isEnabled(DeviceFeature::DescriptorIndexing);
+      if (!bindless) {
+        std::cerr << "bindless textures are not supported by this device, binding a texture set per frame instead" << std::endl;
+      }
+    }
 
     // Fill in creation infor for device
     VkDeviceCreateInfo createInfo{};
+    createInfo.pNext = deviceCapabilities.chain();
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
-    createInfo.queueCreateInfoCount = 1;
-    createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.pEnabledFeatures = deviceCapabilities.coreFeatures();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceCapabilities.extensions().size());
+    createInfo.ppEnabledExtensionNames = deviceCapabilities.extensions().data();
 
     // Add layercount and validation layer data if enabled
     if (enableValidationLayers) {
@@ -348,9 +999,87 @@ private:
     vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
     // Fill handle for presentQueue
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+    shaderModules.init(device);
+    // Uploads share the graphics queue when there is no dedicated transfer family
+    vkGetDeviceQueue(device, indices.transferFamily.value_or(indices.graphicsFamily.value()), 0, &transferQueue);
+
+    // Extension commands and ones newer than Vulkan 1.0 aren't exported by
+    //  the loader, fetch them from the device under their core or extension name
+    if (drawIndirectCountSupported) {
+      bool core = deviceCapabilities.source(DeviceFeature::DrawIndirectCount) == FeatureSource::Core;
+      cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+          vkGetDeviceProcAddr(device, core ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirectCountKHR"));
+      drawIndirectCountSupported = cmdDrawIndexedIndirectCount != nullptr;
+    }
+    if (dynamicRenderingSupported) {
+      bool core = deviceCapabilities.source(DeviceFeature::DynamicRendering) == FeatureSource::Core;
+      cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRendering>(
+          vkGetDeviceProcAddr(device, core ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR"));
+      cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRendering>(
+          vkGetDeviceProcAddr(device, core ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR"));
+      dynamicRenderingSupported = cmdBeginRendering != nullptr && cmdEndRendering != nullptr;
+    }
+    dynamicRendering = options.dynamicRendering && dynamicRenderingSupported;
+
+    deviceCapabilities.print(std::cout);
+    std::cout << "  dedicated transfer queue: " << (indices.transferFamily.has_value() ? "yes" : "no") << std::endl;
+  }
+
+  void createAllocator() {
+    allocator.init(physicalDevice, device);
+
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    stagingRing.init(device, allocator, graphicsQueue, indices.graphicsFamily.value(), STAGING_RING_SIZE);
+
+    if (asyncUploads) {
+      uploader.init(device, allocator, transferQueue, indices.transferFamily.value_or(indices.graphicsFamily.value()),
+          indices.graphicsFamily.value(), STAGING_RING_SIZE);
+    }
+  }
+
+  // The main thread runs jobs while it waits on them, so it takes one hardware thread itself
+  void createJobSystem() {
+    uint32_t workerCount = options.jobThreads;
+    if (workerCount == 0) {
+      workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    }
+    jobs = std::make_unique<JobSystem>(workerCount);
+    std::cout << "job system: " << workerCount << " worker thread(s)" << std::endl;
+  }
+
+  // Reads every shader the pipelines are built from and creates its module,
+  //  a job per file. The modules land in the thread safe shaderModules, where
+  //  creating the pipelines later on finds them
+  void loadShaders(JobCounter& counter) {
+    std::vector<const char*> paths = {"shaders/vert.spv", fragmentShaderPath()};
+    if (gpuCulling) {
+      paths.push_back("shaders/cull.spv");
+    }
+    for (const char* path : paths) {
+      jobs->run([this, path] {createShaderModule(path);}, counter);
+    }
+  }
+
+  // Fills part of a device local buffer, asynchronously on the transfer queue
+  //  when possible. Call submitUploads once everything is queued up
+  void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    if (asyncUploads) {
+      uploader.uploadBuffer(dst, dstOffset, data, size);
+    } else {
+      stagingRing.uploadBuffer(dst, dstOffset, data, size);
+    }
+  }
+
+  void submitUploads() {
+    if (asyncUploads) {
+      uploader.submit();
+    } else {
+      stagingRing.flush();
+    }
   }
 
-  void createSwapChain() {
+  void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
     // Get the surfaceFormat, presentMode, and extent to be used
@@ -394,9 +1123,11 @@ private:
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    // When recreating, hand over the current swap chain so the driver can
+    //  reuse its resources. It is retired by recreateSwapChain
+    createInfo.oldSwapchain = oldSwapChain;
 
-    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, swapChain.put(device)) != VK_SUCCESS) {
       throw std::runtime_error("failed to create swap chain!");
     }
 
@@ -408,6 +1139,109 @@ private:
     swapChainExtent = extent;
   }
 
+  // Rebuilds the swap chain after a resize or once it is out of date, along
+  //  with the image views and framebuffers that depend on its images and extent.
+  //  The pipeline uses dynamic viewport and scissor, so it is kept as is
+  void recreateSwapChain() {
+    // A minimized window has a zero sized framebuffer, wait until it is shown again
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    while (width == 0 || height == 0) {
+      glfwGetFramebufferSize(window, &width, &height);
+      glfwWaitEvents();
+    }
+
+    double recreateMs = 0.0;
+    {
+      ScopedTimer timer(recreateMs);
+
+      // Frames still in flight may use the framebuffers, image views and old
+      //  swap chain, so they are retired instead of waiting for those frames
+      cleanupSwapChain();
+
+      SwapchainHandle oldSwapChain = std::move(swapChain);
+      VkFormat oldImageFormat = swapChainImageFormat;
+      createSwapChain(oldSwapChain);
+      deletionQueue.retire(std::move(oldSwapChain));
+
+      createImageViews();
+      createRenderFinishedSemaphores();
+      // The render pass and pipeline only depend on the image format, which
+      //  practically never changes, but rebuild them if it does
+      if (swapChainImageFormat != oldImageFormat) {
+        // A shader reload may be building against the render pass and layout
+        std::lock_guard<std::mutex> lock(buildMutex);
+        deletionQueue.retire(PipelineHandle(device, pipelines.release(graphicsPipelineDesc)));
+        deletionQueue.retire(std::move(pipelineLayout));
+        deletionQueue.retire(std::move(renderPass));
+        createRenderPass();
+        createGraphicsPipeline();
+      }
+      createRenderGraph();
+      createFrameBuffers();
+    }
+
+    framebufferResized = false;
+    swapChainRecreations++;
+    frameStats.setMetric("swapchain_recreations", swapChainRecreations);
+    frameStats.setMetric("swapchain_recreate_ms", recreateMs);
+  }
+
+  // Retires the framebuffers and image views of the swap chain images, they
+  //  are destroyed once the frames in flight are done with them. The swap
+  //  chain itself outlives them, as it is passed on as oldSwapchain
+  void cleanupSwapChain() {
+    for (FramebufferHandle& framebuffer : swapChainFramebuffers) {
+      deletionQueue.retire(std::move(framebuffer));
+    }
+    swapChainFramebuffers.clear();
+
+    for (ImageViewHandle& imageView : swapChainImageViews) {
+      deletionQueue.retire(std::move(imageView));
+    }
+    swapChainImageViews.clear();
+
+    // The graph's depth buffer has the size of the swap chain images
+    renderGraph.reset();
+  }
+
+  // Creates the device local images rendered into when headless, one per frame
+  //  in flight so a frame never waits on the image of the frame before it
+  void createOffscreenImages() {
+    swapChainImageFormat = HEADLESS_IMAGE_FORMAT;
+    swapChainExtent = {WIDTH, HEIGHT};
+
+    swapChainImages.resize(options.framesInFlight);
+    offscreenImageAllocations.resize(options.framesInFlight);
+
+    for (uint32_t i = 0; i < options.framesInFlight; i++) {
+      // Creation info for the image, usable as color attachment and as copy source for saveImage
+      VkImageCreateInfo imageInfo{};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.format = swapChainImageFormat;
+      imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      if (vkCreateImage(device, &imageInfo, nullptr, &swapChainImages[i]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create offscreen image!");
+      }
+
+      // Back the image with device local memory
+      VkMemoryRequirements memRequirements;
+      vkGetImageMemoryRequirements(device, swapChainImages[i], &memRequirements);
+
+      offscreenImageAllocations[i] = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Optimal);
+      vkBindImageMemory(device, swapChainImages[i], offscreenImageAllocations[i].memory, offscreenImageAllocations[i].offset);
+    }
+  }
+
   void createImageViews() {
     swapChainImageViews.resize(swapChainImages.size());
     
@@ -431,272 +1265,1364 @@ private:
       createInfo.subresourceRange.layerCount = 1;
 
       // Create imageview and put it in imageview vector
-      if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
+      if (vkCreateImageView(device, &createInfo, nullptr, swapChainImageViews[i].put(device)) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image views!");
       }
 
     }
   }
 
+  // Picks the most precise depth format usable as attachment, no stencil is needed
+  VkFormat findDepthFormat() {
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D24_UNORM_S8_UINT,
+                            VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D16_UNORM}) {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+      if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+        return format;
+      }
+    }
+    throw std::runtime_error("failed to find a supported depth format!");
+  }
+
+  // Dynamic rendering names the attachments when rendering starts, so there is no render pass
   void createRenderPass() {
+    depthFormat = findDepthFormat();
+    if (!dynamicRendering) {
+      renderPass = RenderPassHandle(device, makeRenderPass(swapChainImageFormat, depthFormat, VK_SAMPLE_COUNT_1_BIT));
+    }
+  }
+
+  // Creates a render pass with one color and one depth attachment of the given formats and sample count
+  VkRenderPass makeRenderPass(VkFormat format, VkFormat depthFormat, VkSampleCountFlagBits samples) {
     // Description of colorAttachment
     VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.format = format;
+    colorAttachment.samples = samples;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // Clear framebuffer at start (black screen)
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // Render contents stored in memory
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // Contents of stencil data undefined
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Contents of stencil data are undefined after rendering
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // Images are to be presented to the swapchain
+    // The render graph transitions the attachments before and after the pass,
+    //  so the pass itself keeps them in their attachment layouts
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0; // refer to first colorAttachment
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    // Description of depthAttachment, only needed during the pass
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = depthFormat;
+    depthAttachment.samples = samples;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef{};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    // Creation info for renderPass
+    // Creation info for renderPass. No external dependencies, the render
+    //  graph's barriers around the pass order it against everything else
+    VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
 
     // Create renderPass
-    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+    VkRenderPass pass;
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &pass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
+    return pass;
   }
 
   void createGraphicsPipeline() {
-    // read code from SPIR-V Shader files
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
-
-    // Get shader modules from code
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-    // VertShader creation info for pipeline
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule; //shaderModule
-    vertShaderStageInfo.pName = "main"; // entrypoint
-
-    // FragShader creation info for pipeline
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
-
-    VkPipelineShaderStageCreateInfo shaderStages[] = {
-      vertShaderStageInfo, fragShaderStageInfo
-    };
-
-    // ###################
-    // Work here later
-    // ###################
-
-    // Describes way vertex data should be passed to the vertex shader
-    //  Empty for now as vertex data is hard coded into the shader
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.pVertexBindingDescriptions = nullptr; // Optional
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputInfo.pVertexAttributeDescriptions = nullptr; // Optional
-
-    // Describes what geometry is to be drawn from the vertex data
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // Making triangles
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-    // Info for viewport state
-    VkPipelineViewportStateCreateInfo viewportState{};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.scissorCount = 1;
-
-    // Makes vertexshader geometry into fragments for coloring
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f; // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
-
-    // Used in AntiAliasing, disabled for now
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    multisampling.minSampleShading = 1.0f; // Optional
-    multisampling.pSampleMask = nullptr; // Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE; // Optional
-
-    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
-
-    VkPipelineColorBlendStateCreateInfo colorBlending{};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f; // Optional
-    colorBlending.blendConstants[1] = 0.0f; // Optional
-    colorBlending.blendConstants[2] = 0.0f; // Optional
-    colorBlending.blendConstants[3] = 0.0f; // Optional
-
-    // Creating viewport and scissor as dynamic part of the pipeline
-    std::vector<VkDynamicState> dynamicStates = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR
-    };
-    // Creating Vk var for dynamic states of pipeline
-    VkPipelineDynamicStateCreateInfo dynamicState{};
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
-    dynamicState.pDynamicStates = dynamicStates.data();
-
-    // Creation info graphicsPipeline
+    // Per draw transform, small enough to push instead of going through memory
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawPushConstants);
+
+    // Creation info graphicsPipeline, set 0 holds the frame uniforms and set 1 the texture, or every texture when bindless
+    VkDescriptorSetLayout setLayouts[] = {frameDescriptorSetLayout, bindless ? bindlessHeap.layout() : textureDescriptorSetLayout};
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0; // Optional
-    pipelineLayoutInfo.pSetLayouts = nullptr; // Optional
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     // Create pipelineLayout
-    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, pipelineLayout.put(device)) != VK_SUCCESS) {
         throw std::runtime_error("failed to create pipeline layout!");
     }
 
-    VkGraphicsPipelineCreateInfo pipelineInfo{};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = &dynamicState;
-    pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
-    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-    pipelineInfo.basePipelineIndex = -1; // Optional
+    // Filled, depth tested quads with back faces culled and blending off, into renderPass
+    graphicsPipelineDesc = makePipelineDesc(renderPass);
+
+    // Create graphicsPipeline, timing it to show what the pipelineCache saves
+    graphicsPipelineId = pipelines.request(graphicsPipelineDesc);
+    double pipelineMs = pipelines.compile(*jobs);
+    graphicsPipeline = pipelines.get(graphicsPipelineId);
+    // Whether the driver actually reused the loaded data isn't known, only whether there was any
+    std::cout << "graphics pipeline created in " << pipelineMs << " ms ("
+              << (pipelineCacheLoaded ? "pipeline cache loaded" : "cold") << ")" << std::endl;
+    frameStats.setMetric("pipeline_create_ms", pipelineMs);
+
+    // Shader reloads build on top of the new description from now on
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    reloadBaseDesc = graphicsPipelineDesc;
+  }
 
-    // Create graphicsPipeline
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics pipeline!");
-    }
+  // Watches the shader sources, every save recompiles them and rebuilds the
+  //  graphics pipeline on the watcher thread, applyShaderReload swaps it in
+  void startShaderWatcher() {
+    std::vector<ShaderWatcher::Shader> shaders = {
+      {"shader.vert", "shaders/vert.spv"},
+      {bindless ? "bindless.frag" : "shader.frag", fragmentShaderPath()}
+    };
+    shaderWatcher.start("shaders", shaders, [this](const std::vector<std::string>&) {
+      rebuildGraphicsPipeline();
+    });
+    std::cout << "watching shaders/ for changes" << std::endl;
+  }
+
+  // Runs on the watcher thread. Rendering carries on with the current pipeline
+  //  while the new one is built
+  void rebuildGraphicsPipeline() {
+    auto reloadStart = std::chrono::steady_clock::now();
 
-    // Destroy shader modules
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    PipelineDesc desc;
+    {
+      std::lock_guard<std::mutex> lock(reloadMutex);
+      desc = reloadBaseDesc;
+    }
+    SpirvBlob vertexCode = SpirvBlob::fromFile("shaders/vert.spv");
+    SpirvBlob fragmentCode = SpirvBlob::fromFile(fragmentShaderPath());
+
+    // Holding buildMutex keeps the render pass and layout alive while building,
+    //  and the modules, which applyShaderReload releases under it as well
+    std::unique_lock<std::mutex> buildLock(buildMutex);
+    // Modules of unchanged shaders come out of the cache
+    desc.vertexShader = shaderModules.get(vertexCode);
+    desc.fragmentShader = shaderModules.get(fragmentCode);
+    {
+      // They may have been replaced while loading the shaders, the rebuilt
+      //  pipeline picked up the shaders already
+      std::lock_guard<std::mutex> lock(reloadMutex);
+      if (desc.renderPass != reloadBaseDesc.renderPass || desc.layout != reloadBaseDesc.layout) {
+        return;
+      }
+      if (desc == reloadBaseDesc) {
+        std::cout << "shaders unchanged, keeping the current pipeline" << std::endl;
+        reloadedPipeline.reset(); // Built from shaders that were reverted since
+        return;
+      }
+    }
+    PipelineHandle pipeline(device, PipelineRegistry::createPipeline(device, pipelineCache, desc));
+    buildLock.unlock();
+    std::chrono::duration<double, std::milli> reloadTime = std::chrono::steady_clock::now() - reloadStart;
+
+    // A pipeline still waiting to be swapped in is replaced, it was never used
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    reloadedPipeline = std::move(pipeline);
+    reloadedDesc = desc;
+    reloadMs = reloadTime.count();
   }
 
-  void createFrameBuffers() {
-    // Resize vector for framebuffer count
-    swapChainFramebuffers.resize(swapChainImageViews.size());
-    // Create framebuffers
-    for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-      // Create list of attachments from swapChainImageViews
-      VkImageView attachments[] = {
-        swapChainImageViews[i]
-      };
+  // Swaps in a pipeline the shader watcher rebuilt. Called between frames,
+  //  so every draw of a frame uses the same pipeline
+  void applyShaderReload() {
+    PipelineDesc replacedDesc;
+    double appliedReloadMs;
+    {
+      std::lock_guard<std::mutex> lock(reloadMutex);
+      if (reloadedPipeline == VK_NULL_HANDLE) {return;}
+
+      // Built against a render pass or layout that was replaced since
+      if (reloadedDesc.renderPass != renderPass || reloadedDesc.layout != pipelineLayout) {
+        reloadedPipeline.reset();
+        return;
+      }
 
-      // Creation info for framebuffer
-      VkFramebufferCreateInfo framebufferInfo{};
-      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-      framebufferInfo.renderPass = renderPass;
-      framebufferInfo.attachmentCount = 1;
-      framebufferInfo.pAttachments = attachments;
-      framebufferInfo.width = swapChainExtent.width;
-      framebufferInfo.height = swapChainExtent.height;
-      framebufferInfo.layers = 1;
+      // Frames in flight still draw with the old pipeline
+      deletionQueue.retire(PipelineHandle(device, pipelines.release(graphicsPipelineDesc)));
+      replacedDesc = graphicsPipelineDesc;
+      graphicsPipelineDesc = reloadedDesc;
+      reloadBaseDesc = reloadedDesc;
+      graphicsPipeline = pipelines.get(pipelines.adopt(reloadedDesc, reloadedPipeline.release()));
+      appliedReloadMs = reloadMs;
+    }
 
-      if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create framebuffer!");
+    // The graphics pipeline was the only one built from the replaced shaders,
+    //  so their modules go. Should a source be reverted, its module is created again
+    {
+      std::lock_guard<std::mutex> lock(buildMutex);
+      for (VkShaderModule module : {replacedDesc.vertexShader, replacedDesc.fragmentShader}) {
+        if (module != graphicsPipelineDesc.vertexShader && module != graphicsPipelineDesc.fragmentShader) {
+          shaderModules.release(module);
+        }
       }
     }
 
+    shaderReloads++;
+    std::cout << "shaders reloaded, pipeline rebuilt in " << appliedReloadMs << " ms" << std::endl;
+    frameStats.setMetric("shader_reloads", shaderReloads);
+    frameStats.setMetric("shader_reload_ms", appliedReloadMs);
+    frameStats.setMetric("shader_modules", static_cast<double>(shaderModules.size()));
   }
 
-  void createCommandPool() {
-    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-
-    VkCommandPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Command buffers can be rerecorded individually
-    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+  // Bindless rendering samples its textures out of an array, which takes its own fragment shader
+  const char* fragmentShaderPath() const {
+    return bindless ? "shaders/frag_bindless.spv" : "shaders/frag.spv";
+  }
 
-    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create command pool!");
+  // Describes a pipeline drawing the quad instances into pass, with the
+  //  defaults of PipelineDesc for everything the caller doesn't change
+  PipelineDesc makePipelineDesc(VkRenderPass pass) {
+    PipelineDesc desc;
+    // Get shader modules from the SPIR-V files, the cache keeps them for other pipelines
+    desc.vertexShader = createShaderModule("shaders/vert.spv");
+    desc.fragmentShader = createShaderModule(fragmentShaderPath());
+
+    // Describes way vertex data should be passed to the vertex shader,
+    //  the Vertex struct in binding 0 followed by the instance streams
+    desc.bindings.push_back(Vertex::getBindingDescription());
+    for (const auto& description : Vertex::getAttributeDescriptions()) {
+      desc.attributes.push_back(description);
+    }
+    for (const auto& description : InstanceStreams::getBindingDescriptions()) {
+      desc.bindings.push_back(description);
+    }
+    for (const auto& description : InstanceStreams::getAttributeDescriptions()) {
+      desc.attributes.push_back(description);
     }
-  }
 
-  void createCommandBuffers() {
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // Can be submitted to a queue for execution, but cannot be called from other command buffers.
-    allocInfo.commandBufferCount = 1;
+    // Opaque, so nearer draws hide farther ones through the depth test
+    desc.depthTest = true;
+    desc.depthWrite = true;
 
-    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate command buffers!");
+    desc.layout = pipelineLayout;
+    desc.renderPass = pass;
+    desc.colorFormat = swapChainImageFormat;
+    desc.depthFormat = depthFormat;
+    return desc;
+  }
+
+  // Sets up the layout cache, the allocator for long lived sets and one for the
+  //  sets of each frame in flight
+  void createDescriptorAllocators() {
+    descriptorLayouts.init(device);
+
+    // Long lived sets are few, the uniform ring and textures
+    descriptorAllocator.init(device, {
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f}
+    });
+
+    // Per frame sets point at buffers and views that change every frame, such
+    //  as the culling buffers and the views of streamed textures
+    frameDescriptorAllocators.resize(options.framesInFlight);
+    for (DescriptorAllocator& frameAllocator : frameDescriptorAllocators) {
+      frameAllocator.init(device, {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f}
+      });
     }
   }
 
-  void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0; // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+  // Creates the uniform ring's buffer, persistently mapped, and a descriptor
+  //  set for it whose offset is given at bind time
+  void createFrameUniforms() {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    createBuffer(UNIFORM_RING_REGION_SIZE * options.framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        uniformBuffer, uniformBufferAllocation);
+    uniformRing.init(uniformBufferAllocation.mapped, UNIFORM_RING_REGION_SIZE, deviceProperties.limits.minUniformBufferOffsetAlignment);
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    frameDescriptorSetLayout = descriptorLayouts.get({binding});
+    frameDescriptorSet = descriptorAllocator.allocate(frameDescriptorSetLayout);
+
+    // The range is one FrameUniforms, the dynamic offset picks which one
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = uniformBuffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(FrameUniforms);
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = frameDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
 
-    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-      throw std::runtime_error("failed to begin recording command buffer!");
+  // Creates the quads' texture and the white one standing in for it while it
+  //  streams in. Their uploads are recorded by the first frames
+  void createTextures() {
+    textures.init(physicalDevice, device, allocator, deletionQueue, options.framesInFlight);
+    if (bindless) {
+      bindlessHeap.init(device);
+    }
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    textureDescriptorSetLayout = descriptorLayouts.get({binding});
+
+    // Queued first, so it is always uploaded by the first frame
+    uint32_t white = 0xffffffff;
+    fallbackTexture = textures.create(1, 1, &white, false);
+
+    // Checkerboard with thin cells, which shimmers without its mips
+    std::vector<uint32_t> texels(TEXTURE_SIZE * TEXTURE_SIZE);
+    for (uint32_t y = 0; y < TEXTURE_SIZE; y++) {
+      for (uint32_t x = 0; x < TEXTURE_SIZE; x++) {
+        bool light = ((x / 8) + (y / 8)) % 2 == 0;
+        texels[y * TEXTURE_SIZE + x] = light ? 0xffffffff : 0xff404040; // ABGR, read as RGBA8 bytes
+      }
+    }
+    quadTexture = textures.create(TEXTURE_SIZE, TEXTURE_SIZE, texels.data(), options.streamTextures);
+  }
+
+  // Records this frame's texture uploads and points the frame's texture set at
+  //  the quads' texture, or at the fallback while none of it is uploaded.
+  //  Streamed textures get a new view as levels arrive, hence a set per frame
+  void recordTextures(VkCommandBuffer commandBuffer) {
+    textures.recordUploads(commandBuffer, currentFrame);
+    if (textureCompleteFrame == 0 && textures.isComplete(quadTexture)) {
+      textureCompleteFrame = frameCount + 1;
+      frameStats.setMetric("texture_complete_frames", textureCompleteFrame);
+    }
+
+    if (bindless) {
+      updateBindlessTextures();
+      return;
+    }
+
+    TextureManager::TextureId texture = textures.isResident(quadTexture) ? quadTexture : fallbackTexture;
+    textureDescriptorSet = frameDescriptorAllocators[currentFrame].allocate(textureDescriptorSetLayout);
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = textures.sampler(texture);
+    imageInfo.imageView = textures.view(texture);
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = textureDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  // Gives every texture whose view changed since the last frame a new bindless
+  //  slot, and points the draws sampling it there. Frames in flight may still
+  //  read the old slot, so it is only freed once they are done
+  void updateBindlessTextures() {
+    bindlessTextures.resize(textures.count());
+
+    bool changed = false;
+    for (TextureManager::TextureId id = 0; id < textures.count(); id++) {
+      BindlessTexture& entry = bindlessTextures[id];
+      if (!textures.isResident(id) || textures.view(id) == entry.view) {
+        continue;
+      }
+
+      if (entry.view != VK_NULL_HANDLE) {
+        uint32_t oldSlot = entry.slot;
+        deletionQueue.defer([this, oldSlot]() {bindlessHeap.removeTexture(oldSlot);});
+      }
+      entry.view = textures.view(id);
+      entry.slot = bindlessHeap.addTexture(entry.view, textures.sampler(id));
+      changed = true;
+    }
+
+    // Indices are pushed along with every draw, so they only change here
+    if (changed) {
+      for (DrawCommand& draw : drawList) {
+        draw.constants.textureIndex = bindlessTextureIndex(draw.texture);
+      }
+      frameStats.setMetric("bindless_texture_slots", bindlessHeap.textureCount());
+    }
+  }
+
+  // Slot sampled for the texture, the fallback's while none of it is uploaded
+  uint32_t bindlessTextureIndex(TextureManager::TextureId texture) const {
+    const BindlessTexture& entry = bindlessTextures[texture];
+    return entry.view != VK_NULL_HANDLE ? entry.slot : bindlessTextures[fallbackTexture].slot;
+  }
+
+  // Writes this frame's uniforms into its region of the ring. The GPU is done
+  //  with the region, as the frame's fence was waited on
+  void updateFrameUniforms() {
+    uniformRing.beginFrame(currentFrame);
+
+    // No camera yet, the identity keeps instances in clip space
+    memset(frameUniforms.viewProjection, 0, sizeof(frameUniforms.viewProjection));
+    for (int i = 0; i < 4; i++) {
+      frameUniforms.viewProjection[i * 4 + i] = 1.0f;
+    }
+    frameUniforms.time = static_cast<float>(frameCount) / 60.0f;
+
+    frameUniformOffset = uniformRing.push(frameUniforms);
+  }
+
+  void createPipelineCache() {
+    std::vector<char> cacheData;
+
+    // Load previous cache data if there is any, keeping it only if it was
+    //  written by this exact device and driver
+    if (!options.pipelineCachePath.empty() && std::ifstream(options.pipelineCachePath).good()) {
+      auto loadStart = std::chrono::steady_clock::now();
+      cacheData = readFile(options.pipelineCachePath);
+      std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - loadStart;
+
+      if (isPipelineCacheCompatible(cacheData)) {
+        std::cout << "loaded pipeline cache (" << cacheData.size() << " bytes) in " << loadTime.count() << " ms" << std::endl;
+      } else {
+        std::cout << "discarding stale pipeline cache " << options.pipelineCachePath << std::endl;
+        cacheData.clear();
+      }
+    }
+
+    // Creation info for pipelineCache, seeded with the loaded data
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = cacheData.size();
+    cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+    pipelineCacheLoaded = !cacheData.empty();
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, pipelineCache.put(device)) == VK_SUCCESS) {
+      return;
+    }
+
+    // Drivers may still refuse data that passed the header check, start empty instead
+    cacheInfo.initialDataSize = 0;
+    cacheInfo.pInitialData = nullptr;
+    pipelineCacheLoaded = false;
+    if (vkCreatePipelineCache(device, &cacheInfo, nullptr, pipelineCache.put(device)) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline cache!");
+    }
+  }
+
+  // Checks the cache header against the physical device, as cache data from
+  //  another device or driver version is useless at best
+  bool isPipelineCacheCompatible(const std::vector<char>& cacheData) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (cacheData.size() < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, cacheData.data(), sizeof(header));
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    return header.headerSize >= sizeof(header) &&
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == deviceProperties.vendorID &&
+        header.deviceID == deviceProperties.deviceID &&
+        memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+  }
+
+  void savePipelineCache() {
+    if (options.pipelineCachePath.empty()) {return;}
+
+    // Get size of the cache data, then the data itself
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+      return;
+    }
+    std::vector<char> cacheData(dataSize);
+    if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS) {
+      return;
+    }
+
+    // Write to a temporary file first and rename it over the old cache,
+    //  so an interrupted write never leaves a truncated cache behind
+    std::string tempPath = options.pipelineCachePath + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "failed to write pipeline cache " << tempPath << std::endl;
+      return;
+    }
+    file.write(cacheData.data(), dataSize);
+    file.close();
+
+    if (!file || std::rename(tempPath.c_str(), options.pipelineCachePath.c_str()) != 0) {
+      std::cerr << "failed to write pipeline cache " << options.pipelineCachePath << std::endl;
+      std::remove(tempPath.c_str());
+    }
+  }
+
+  // Framebuffers only exist for render pass objects, dynamic rendering uses the image views directly
+  void createFrameBuffers() {
+    if (dynamicRendering) {
+      return;
+    }
+
+    // Resize vector for framebuffer count
+    swapChainFramebuffers.resize(swapChainImageViews.size());
+    // Create framebuffers
+    for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+      // Create list of attachments from swapChainImageViews
+      VkImageView attachments[] = {
+        swapChainImageViews[i],
+        renderGraph.view(depthTarget)
+      };
+
+      // Creation info for framebuffer
+      VkFramebufferCreateInfo framebufferInfo{};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = renderPass;
+      framebufferInfo.attachmentCount = 2;
+      framebufferInfo.pAttachments = attachments;
+      framebufferInfo.width = swapChainExtent.width;
+      framebufferInfo.height = swapChainExtent.height;
+      framebufferInfo.layers = 1;
+
+      if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, swapChainFramebuffers[i].put(device)) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create framebuffer!");
+      }
+    }
+
+  }
+
+  void createCommandPool() {
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Command buffers can be rerecorded individually
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, commandPool.put(device)) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+  }
+
+  void createVertexBuffer() {
+    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+
+    // Device local, filled through the staging ring
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferAllocation);
+    uploadBuffer(vertexBuffer, 0, vertices.data(), bufferSize);
+  }
+
+  void createIndexBuffer() {
+    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+
+    // Device local, filled through the staging ring
+    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferAllocation);
+    uploadBuffer(indexBuffer, 0, indices.data(), bufferSize);
+  }
+
+  void createCommandBuffers() {
+    // One command buffer per frame in flight, so a frame can be recorded
+    //  while the GPU still executes the previous one
+    commandBuffers.resize(options.framesInFlight);
+    frameArenas.resize(options.framesInFlight);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // Can be submitted to a queue for execution, but cannot be called from other command buffers.
+    allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers!");
+    }
+  }
+
+  // Lays out count instances of the quad on a grid covering the screen,
+  //  in ranges of INSTANCE_JOB_GRAIN instances spread over the job system
+  void createInstances(size_t count) {
+    uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+    float cellSize = 2.0f / columns;
+
+    instances.basePositions.resize(count);
+    instances.phases.resize(count);
+    instances.scales.assign(count, cellSize * 0.5f); // A lone instance keeps the quad's size
+    instances.colors.resize(count);
+
+    auto layOut = [this, columns, cellSize](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        uint32_t column = i % columns;
+        uint32_t row = static_cast<uint32_t>(i / columns);
+        instances.basePositions[i] = {-1.0f + (column + 0.5f) * cellSize, -1.0f + (row + 0.5f) * cellSize};
+        instances.phases[i] = static_cast<float>(i) * 0.1f;
+
+        // Shade from white in the first column to blue-green in the last, a lone instance stays white
+        uint32_t fade = columns > 1 ? 255 - column * 191 / (columns - 1) : 255;
+        instances.colors[i] = fade | (255u << 8) | (255u << 16) | (255u << 24);
+      }
+    };
+    JobCounter laidOut;
+    jobs->parallelFor(count, INSTANCE_JOB_GRAIN, layOut, laidOut);
+    jobs->wait(laidOut);
+  }
+
+  // Host visible instance buffers, persistently mapped. The static streams
+  //  are written once here, only the offsets get rewritten every frame.
+  //  Culling writes the offsets stream as a storage buffer
+  void createInstanceBuffers() {
+    VkDeviceSize bufferSize = InstanceStreams::getBufferSize(instances.size());
+    auto streamOffsets = InstanceStreams::getStreamOffsets(instances.size());
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    if (gpuCulling) {
+      usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+      // The descriptor recordCulling binds starts at the offsets stream
+      VkDeviceSize alignment = deviceCapabilities.properties().limits.minStorageBufferOffsetAlignment;
+      if (streamOffsets[0] % alignment != 0) {
+        throw std::runtime_error("instance offsets stream is not aligned for a storage buffer!");
+      }
+    }
+
+    instanceBuffers.resize(options.framesInFlight);
+    instanceBufferAllocations.resize(options.framesInFlight);
+    for (uint32_t i = 0; i < options.framesInFlight; i++) {
+      createBuffer(bufferSize, usage,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          instanceBuffers[i], instanceBufferAllocations[i]);
+
+      char* mapped = static_cast<char*>(instanceBufferAllocations[i].mapped);
+      memcpy(mapped + streamOffsets[1], instances.scales.data(), instances.scales.size() * sizeof(float));
+      memcpy(mapped + streamOffsets[2], instances.colors.data(), instances.colors.size() * sizeof(uint32_t));
+    }
+  }
+
+  void destroyInstanceBuffers() {
+    for (size_t i = 0; i < instanceBuffers.size(); i++) {
+      destroyBuffer(instanceBuffers[i], instanceBufferAllocations[i]);
+    }
+    instanceBuffers.clear();
+    instanceBufferAllocations.clear();
+  }
+
+  // Moves every instance around its grid position, writing the offsets stream
+  //  of the current frame's instance buffer front to back. Time advances per
+  //  frame rather than per second so headless output is reproducible. Each
+  //  job writes its own range of INSTANCE_JOB_GRAIN instances
+  void updateInstances() {
+    float time = static_cast<float>(frameCount) / 60.0f;
+    float radius = instances.scales.empty() ? 0.0f : instances.scales[0] * 0.25f;
+
+    Vec2* offsets = reinterpret_cast<Vec2*>(static_cast<char*>(instanceBufferAllocations[currentFrame].mapped) +
+        InstanceStreams::getStreamOffsets(instances.size())[0]);
+    const Vec2* basePositions = instances.basePositions.data();
+    const float* phases = instances.phases.data();
+
+    auto animate = [=](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        offsets[i].x = basePositions[i].x + radius * std::cos(time + phases[i]);
+        offsets[i].y = basePositions[i].y + radius * std::sin(time + phases[i]);
+      }
+    };
+    JobCounter animated;
+    jobs->parallelFor(instances.size(), INSTANCE_JOB_GRAIN, animate, animated);
+    jobs->wait(animated);
+  }
+
+  // Layout of the compute pipeline culling the objects against the view
+  //  frustum, its descriptor sets are allocated per frame by recordCulling
+  void createCullingPipelineLayout() {
+    // Objects, instance offsets, draw commands and draw count
+    std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    cullDescriptorSetLayout = descriptorLayouts.get({bindings.begin(), bindings.end()});
+
+    // Frustum planes and object count change without touching the descriptors
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    VkDescriptorSetLayout setLayout = cullDescriptorSetLayout;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, cullPipelineLayout.put(device)) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create culling pipeline layout!");
+    }
+  }
+
+  // Only touches the thread safe shader module and pipeline caches, so it
+  //  runs as a job while the graphics pipeline compiles
+  void createCullingPipeline() {
+    VkShaderModule cullShaderModule = createShaderModule("shaders/cull.spv");
+
+    VkPipelineShaderStageCreateInfo stageInfo{};
+    stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stageInfo.module = cullShaderModule;
+    stageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = stageInfo;
+    pipelineInfo.layout = cullPipelineLayout;
+
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, cullPipeline.put(device)) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create culling pipeline!");
+    }
+  }
+
+  // One object per instance, drawing the quad. Also creates every frame's draw
+  //  command and count buffers and points the descriptor sets at them
+  void createCullingBuffers() {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    cullObjectCount = static_cast<uint32_t>(instances.size());
+    if (cullObjectCount > deviceProperties.limits.maxDrawIndirectCount) {
+      std::cerr << "only drawing the first " << deviceProperties.limits.maxDrawIndirectCount
+                << " of " << cullObjectCount << " objects, the most one indirect draw allows" << std::endl;
+      cullObjectCount = deviceProperties.limits.maxDrawIndirectCount;
+    }
+
+    // The quad spans -0.5 to 0.5 before scaling, so its corners are sqrt(0.5) away from its center
+    std::vector<CullObject> objects(cullObjectCount);
+    for (uint32_t i = 0; i < cullObjectCount; i++) {
+      objects[i] = {{0.0f, 0.0f, 0.0f, instances.scales[i] * std::sqrt(0.5f)},
+          static_cast<uint32_t>(indices.size()), 0, 0, 0};
+    }
+
+    VkDeviceSize objectBufferSize = sizeof(CullObject) * objects.size();
+    createBuffer(objectBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, objectBuffer, objectBufferAllocation);
+    uploadBuffer(objectBuffer, 0, objects.data(), objectBufferSize);
+    submitUploads();
+
+    VkDeviceSize indirectBufferSize = sizeof(VkDrawIndexedIndirectCommand) * cullObjectCount;
+    indirectBuffers.resize(options.framesInFlight);
+    indirectBufferAllocations.resize(options.framesInFlight);
+    indirectCountBuffers.resize(options.framesInFlight);
+    indirectCountBufferAllocations.resize(options.framesInFlight);
+
+    for (uint32_t i = 0; i < options.framesInFlight; i++) {
+      // Written by the culling shader and cleared with vkCmdFillBuffer
+      createBuffer(indirectBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectBuffers[i], indirectBufferAllocations[i]);
+      createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectCountBuffers[i], indirectCountBufferAllocations[i]);
+    }
+  }
+
+  void destroyCullingBuffers() {
+    for (uint32_t i = 0; i < indirectBuffers.size(); i++) {
+      destroyBuffer(indirectBuffers[i], indirectBufferAllocations[i]);
+      destroyBuffer(indirectCountBuffers[i], indirectCountBufferAllocations[i]);
+    }
+    indirectBuffers.clear();
+    indirectBufferAllocations.clear();
+    indirectCountBuffers.clear();
+    indirectCountBufferAllocations.clear();
+
+    destroyBuffer(objectBuffer, objectBufferAllocation);
+  }
+
+  // Splits the instances evenly over drawCount draws of the quad. A single
+  //  draw renders every instance, one draw per instance stands in for a scene
+  //  of separate objects. The draws lie at depths in no particular order, as
+  //  a scene's objects would, and are then sorted front to back
+  void createDrawList() {
+    uint32_t instanceCount = static_cast<uint32_t>(instances.size());
+    uint32_t drawCount = std::min(options.drawCount, instanceCount);
+
+    drawList.resize(drawCount);
+    for (uint32_t i = 0; i < drawCount; i++) {
+      uint32_t firstInstance = static_cast<uint32_t>(static_cast<uint64_t>(instanceCount) * i / drawCount);
+      uint32_t endInstance = static_cast<uint32_t>(static_cast<uint64_t>(instanceCount) * (i + 1) / drawCount);
+      // Golden ratio steps spread the depths over [0, 1) out of order
+      float depth = std::fmod(i * 0.618034f, 1.0f);
+      drawList[i] = {static_cast<uint32_t>(indices.size()), 0, 0, endInstance - firstInstance, firstInstance, quadTexture, {{0.0f, 0.0f}, 1.0f, depth, 0}};
+    }
+    sortDrawList();
+  }
+
+  // Orders the draw list by pipeline and then front to back, so the depth
+  //  test rejects hidden fragments before they are shaded
+  void sortDrawList() {
+    double sortMs = 0.0;
+    {
+      ScopedTimer timer(sortMs);
+      std::vector<uint64_t> keys(drawList.size());
+      for (size_t i = 0; i < drawList.size(); i++) {
+        keys[i] = makeDrawSortKey(graphicsPipelineId, drawList[i].constants.depth);
+      }
+
+      std::vector<uint32_t> order = radixSortDraws(keys);
+      std::vector<DrawCommand> sorted(drawList.size());
+      for (size_t i = 0; i < order.size(); i++) {
+        sorted[i] = drawList[order[i]];
+      }
+      drawList.swap(sorted);
+    }
+    frameStats.setMetric("draw_sort_ms", sortMs);
+  }
+
+  // Splits recording into sliceCount secondary command buffers, each with
+  //  its own command pool per frame in flight, as command pools can't be
+  //  used from several threads. Only one job records a slice at a time
+  void createRecordingContexts(uint32_t sliceCount) {
+    destroyRecordingContexts();
+    if (sliceCount == 0) {
+      return;
+    }
+
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Reset as a whole every frame
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+    recordingContexts.resize(options.framesInFlight);
+    for (std::vector<RecordingContext>& frameContexts : recordingContexts) {
+      frameContexts.resize(sliceCount);
+      for (RecordingContext& context : frameContexts) {
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &context.commandPool) != VK_SUCCESS) {
+          throw std::runtime_error("failed to create recording command pool!");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = context.commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY; // Executed from the primary command buffer
+        allocInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(device, &allocInfo, &context.commandBuffer) != VK_SUCCESS) {
+          throw std::runtime_error("failed to allocate secondary command buffer!");
+        }
+      }
+    }
+  }
+
+  void destroyRecordingContexts() {
+    for (const std::vector<RecordingContext>& frameContexts : recordingContexts) {
+      for (const RecordingContext& context : frameContexts) {
+        vkDestroyCommandPool(device, context.commandPool, nullptr);
+      }
+    }
+    recordingContexts.clear();
+  }
+
+  void createSyncObjects() {
+    imageAvailableSemaphores.resize(options.framesInFlight);
+    inFlightFences.resize(options.framesInFlight);
+    deletionQueue.init(options.framesInFlight);
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Start signaled so the first wait on each frame returns immediately
+
+    for (uint32_t i = 0; i < options.framesInFlight; i++) {
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, imageAvailableSemaphores[i].put(device)) != VK_SUCCESS ||
+          vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create synchronization objects for a frame!");
+      }
+    }
+
+    createRenderFinishedSemaphores();
+  }
+
+  // One per swap chain image, indexed by the image presented. The previous
+  //  set may still be waited on by presents in flight, so it is retired
+  void createRenderFinishedSemaphores() {
+    for (SemaphoreHandle& semaphore : renderFinishedSemaphores) {
+      deletionQueue.retire(std::move(semaphore));
+    }
+    renderFinishedSemaphores.clear();
+    renderFinishedSemaphores.resize(swapChainImages.size());
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (SemaphoreHandle& semaphore : renderFinishedSemaphores) {
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, semaphore.put(device)) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create render finished semaphore!");
+      }
+    }
+  }
+
+  void drawFrame() {
+    uint64_t allocationsBefore = heapAllocationCount.load(std::memory_order_relaxed);
+
+    // CPU timings of this frame, its GPU time is filled in once the frame is done
+    FrameTimings timings;
+    timings.frameNumber = frameCount;
+    auto frameStart = std::chrono::steady_clock::now();
+    if (frameCount > 0) {
+      timings.frameMs = std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count();
+    } else {
+      timings.frameMs = -1.0; // No previous frame to measure against
+    }
+    lastFrameStart = frameStart;
+
+    // Wait until the GPU is done with the last use of this frame's command buffer
+    {
+      ScopedTimer timer(timings.waitMs);
+      vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+
+    // Objects retired before this frame in flight's last submission are unused now
+    deletionQueue.frameCompleted(currentFrame);
+
+    // Frame boundary, pick up a pipeline rebuilt from reloaded shaders
+    if (options.watchShaders) {
+      applyShaderReload();
+    }
+
+    // The last use of this frame's queries is done as well
+    collectGpuTimestamps(currentFrame);
+
+    // Get the next swapchain image, imageAvailable is signaled once it can be written to.
+    //  Headless frames own their offscreen image, so there is nothing to acquire
+    uint32_t imageIndex = currentFrame;
+    if (!options.headless) {
+      VkResult result;
+      {
+        ScopedTimer timer(timings.acquireMs);
+        result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+      }
+
+      // An out of date swap chain can't be rendered to, rebuild it and try again
+      //  next frame. A suboptimal one still works and is rebuilt after presenting
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        recreateSwapChain();
+        return;
+      } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        throw std::runtime_error("failed to acquire swap chain image!");
+      }
+    }
+
+    // Only reset the fence once work is sure to be submitted with it,
+    //  otherwise the wait above would deadlock on the next try
+    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+    // The GPU is done with this frame's instance buffer, fill in this frame's instances
+    {
+      ScopedTimer timer(timings.updateMs);
+      updateInstances();
+      updateFrameUniforms();
+    }
+
+    // Rerecord this frame's command buffer for the acquired image
+    {
+      ScopedTimer timer(timings.recordMs);
+      vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+      recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    }
+
+    // Submit the command buffer, waiting for the image before writing colors
+    //  and for uploads this frame acquired before anything else, signaling
+    //  renderFinished and the frame fence when done
+    FrameArena& arena = frameArenas[currentFrame];
+    ArenaVector<VkSemaphore> waitSemaphores{ArenaAllocator<VkSemaphore>(arena)};
+    ArenaVector<VkPipelineStageFlags> waitStages{ArenaAllocator<VkPipelineStageFlags>(arena)};
+    ArenaVector<uint64_t> waitValues{ArenaAllocator<uint64_t>(arena)}; // Only read for the timeline semaphore
+    waitSemaphores.reserve(2);
+    waitStages.reserve(2);
+    waitValues.reserve(2);
+    if (!options.headless) {
+      waitSemaphores.push_back(imageAvailableSemaphores[currentFrame]);
+      waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+      waitValues.push_back(0);
+    }
+    if (uploadWaitValue > 0) {
+      waitSemaphores.push_back(uploader.semaphore());
+      waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+      waitValues.push_back(uploadWaitValue);
+    }
+    VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[imageIndex]};
+
+    VkTimelineSemaphoreSubmitInfo timelineSubmitInfo{};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+    timelineSubmitInfo.pWaitSemaphoreValues = waitValues.data();
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = uploadWaitValue > 0 ? &timelineSubmitInfo : nullptr;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+    submitInfo.signalSemaphoreCount = options.headless ? 0 : 1;
+    submitInfo.pSignalSemaphores = signalSemaphores;
+
+    {
+      ScopedTimer timer(timings.submitMs);
+      if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+      }
+    }
+
+    // Remember which frame this frame in flight's queries belong to
+    timestampFrameNumbers[currentFrame] = frameCount;
+    deletionQueue.frameSubmitted(currentFrame);
+    frameCount++;
+    lastImageIndex = imageIndex;
+
+    // Present the image once rendering has finished,
+    //  headless frames are done once submitted
+    if (!options.headless) {
+      VkSwapchainKHR swapChains[] = {swapChain};
+
+      VkPresentInfoKHR presentInfo{};
+      presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      presentInfo.waitSemaphoreCount = 1;
+      presentInfo.pWaitSemaphores = signalSemaphores;
+      presentInfo.swapchainCount = 1;
+      presentInfo.pSwapchains = swapChains;
+      presentInfo.pImageIndices = &imageIndex;
+      presentInfo.pResults = nullptr; // Optional
+
+      VkResult result;
+      {
+        ScopedTimer timer(timings.presentMs);
+        result = vkQueuePresentKHR(presentQueue, &presentInfo);
+      }
+
+      if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+        recreateSwapChain();
+      } else if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to present swap chain image!");
+      }
+    }
+
+    frameStats.recordFrame(timings);
+
+    if (frameCount > ALLOCATION_WARMUP_FRAMES) {
+      steadyStateAllocations += heapAllocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+    }
+
+    // Move on to the next frame in flight, the CPU can now record it while
+    //  the GPU still works on this one
+    currentFrame = (currentFrame + 1) % options.framesInFlight;
+  }
+
+  void createTimestampQueryPool() {
+    // Timestamps need support from both the device and the graphics queue family
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t validBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+    timestampFrameNumbers.assign(options.framesInFlight, NO_FRAME);
+    if (validBits == 0 || deviceProperties.limits.timestampPeriod == 0.0f) {
+      std::cout << "GPU timestamps not supported, only CPU times will be reported" << std::endl;
+      return;
+    }
+    timestampPeriod = deviceProperties.limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ULL : (1ULL << validBits) - 1;
+
+    // A begin and end timestamp per frame in flight
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = options.framesInFlight * 2;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, timestampQueryPool.put(device)) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create timestamp query pool!");
+    }
+  }
+
+  // Reads back the render pass timestamps of the frame last submitted with the
+  //  given frame in flight, which must be known to be finished
+  void collectGpuTimestamps(uint32_t frame) {
+    if (timestampQueryPool == VK_NULL_HANDLE || timestampFrameNumbers[frame] == NO_FRAME) {return;}
+
+    uint64_t timestamps[2];
+    if (vkGetQueryPoolResults(device, timestampQueryPool, frame * 2, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+      uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+      frameStats.recordGpuTime(timestampFrameNumbers[frame], ticks * timestampPeriod / 1e6);
+    }
+    timestampFrameNumbers[frame] = NO_FRAME;
+  }
+
+  // Prints the frame stats and writes them to the requested files
+  void reportFrameStats() {
+    // Every frame is done by now, so pick up the outstanding GPU times
+    for (uint32_t i = 0; i < options.framesInFlight; i++) {
+      collectGpuTimestamps(i);
+    }
+
+    if (frameCount > ALLOCATION_WARMUP_FRAMES) {
+      size_t arenaBytes = 0;
+      for (const FrameArena& arena : frameArenas) {
+        arenaBytes = std::max(arenaBytes, arena.highWaterBytes());
+      }
+      frameStats.setMetric("steady_state_allocations", steadyStateAllocations);
+      frameStats.setMetric("frame_arena_bytes", arenaBytes);
+    }
+
+    frameStats.printSummary(std::cout);
+    if (!options.statsCsvPath.empty()) {
+      frameStats.writeCsv(options.statsCsvPath);
+    }
+    if (!options.statsJsonPath.empty()) {
+      frameStats.writeJson(options.statsJsonPath);
+    }
+  }
+
+  void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    // Descriptor sets from this frame in flight's last recording are no longer
+    //  used, the GPU is done with that frame or it was never submitted
+    frameDescriptorAllocators[currentFrame].reset();
+    frameArenas[currentFrame].reset();
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0; // Optional
+    beginInfo.pInheritanceInfo = nullptr; // Optional
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording command buffer!");
+    }
+
+    // Take over the buffers uploaded on the transfer queue since the last frame
+    uploadWaitValue = asyncUploads ? uploader.recordAcquire(commandBuffer) : 0;
+
+    // Texture uploads go before the render pass, the draws sample what they wrote
+    recordTextures(commandBuffer);
+
+    // The queries of this frame in flight were read back in drawFrame before
+    //  recording, so they can be reset. The main pass writes them
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdResetQueryPool(commandBuffer, timestampQueryPool, currentFrame * 2, 2);
+    }
+
+    // Point the graph at this frame's image and buffers and record its passes
+    recordingImageIndex = imageIndex;
+    renderGraph.bindImage(colorTarget, swapChainImages[imageIndex]);
+    if (gpuCulling) {
+      renderGraph.bindBuffer(indirectTarget, indirectBuffers[currentFrame]);
+      renderGraph.bindBuffer(indirectCountTarget, indirectCountBuffers[currentFrame]);
+    }
+    renderGraph.execute(commandBuffer, frameArenas[currentFrame]);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer!");
+    }
+  }
+
+  // Declares the passes of a frame and the resources they use, the graph
+  //  works out the barriers in between. Rebuilt along with the swap chain, as
+  //  the depth buffer has its extent
+  void createRenderGraph() {
+    renderGraph.reset();
+
+    // The frame waits for the swap chain image at the color output stage, then
+    //  hands it to presentation, or to saveImage when headless
+    colorTarget = renderGraph.importImage("swap chain image", VK_IMAGE_ASPECT_COLOR_BIT,
+        {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, false},
+        options.headless ? USAGE_TRANSFER_READ : USAGE_PRESENT);
+    depthTarget = renderGraph.createImage("depth", {depthFormat, swapChainExtent,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT});
+
+    // Both attachments are cleared, nothing from before the pass is kept
+    std::vector<RenderGraph::Access> mainAccesses = {{colorTarget, USAGE_COLOR_ATTACHMENT, true}, {depthTarget, USAGE_DEPTH_ATTACHMENT, true}};
+
+    if (gpuCulling) {
+      indirectTarget = renderGraph.importBuffer("indirect draws");
+      indirectCountTarget = renderGraph.importBuffer("indirect draw count");
+
+      std::vector<RenderGraph::Access> clearAccesses = {{indirectCountTarget, USAGE_TRANSFER_WRITE, true}};
+      if (!drawIndirectCountSupported) {
+        clearAccesses.push_back({indirectTarget, USAGE_TRANSFER_WRITE, true});
+      }
+      renderGraph.addPass("clear draw count", clearAccesses, [this](VkCommandBuffer commandBuffer) {recordCullClear(commandBuffer);});
+      renderGraph.addPass("cull", {{indirectTarget, USAGE_COMPUTE_STORAGE}, {indirectCountTarget, USAGE_COMPUTE_STORAGE}},
+          [this](VkCommandBuffer commandBuffer) {recordCulling(commandBuffer);});
+
+      mainAccesses.push_back({indirectTarget, USAGE_INDIRECT_READ});
+      mainAccesses.push_back({indirectCountTarget, USAGE_INDIRECT_READ});
+    }
+
+    renderGraph.addPass("main", mainAccesses, [this](VkCommandBuffer commandBuffer) {recordMainPass(commandBuffer);});
+    renderGraph.compile();
+
+    frameStats.setMetric("render_graph_passes", static_cast<double>(renderGraph.passCount() - renderGraph.culledPassCount()));
+    frameStats.setMetric("render_graph_culled_passes", static_cast<double>(renderGraph.culledPassCount()));
+    frameStats.setMetric("render_graph_barriers", static_cast<double>(renderGraph.barrierCount()));
+    frameStats.setMetric("render_graph_transient_bytes", static_cast<double>(renderGraph.transientBytes()));
+  }
+
+  // Renders the draw list into the swap chain image, with the draw commands
+  //  culling wrote when gpuCulling is on. Timestamped on its own, so gpu_ms
+  //  leaves out the culling passes before it
+  void recordMainPass(VkCommandBuffer commandBuffer) {
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentFrame * 2);
+    }
+
+    if (gpuCulling) {
+      // Culling filled in the draw commands, so there is nothing left for
+      //  recording threads to split up
+      beginMainPass(commandBuffer, false);
+      recordDrawState(commandBuffer);
+      if (drawIndirectCountSupported) {
+        cmdDrawIndexedIndirectCount(commandBuffer, indirectBuffers[currentFrame], 0, indirectCountBuffers[currentFrame], 0,
+            cullObjectCount, sizeof(VkDrawIndexedIndirectCommand));
+      } else {
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[currentFrame], 0, cullObjectCount, sizeof(VkDrawIndexedIndirectCommand));
+      }
+    } else if (!recordingContexts.empty()) {
+      // Jobs record slices of the draw list into their own secondary
+      //  command buffers, which the render pass then executes in order
+      recordSecondaryCommandBuffers(dynamicRendering ? VK_NULL_HANDLE : swapChainFramebuffers[recordingImageIndex].get());
+
+      ArenaVector<VkCommandBuffer> secondaryCommandBuffers{ArenaAllocator<VkCommandBuffer>(frameArenas[currentFrame])};
+      secondaryCommandBuffers.reserve(recordingContexts[currentFrame].size());
+      for (const RecordingContext& context : recordingContexts[currentFrame]) {
+        secondaryCommandBuffers.push_back(context.commandBuffer);
+      }
+
+      beginMainPass(commandBuffer, true);
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+    } else {
+      beginMainPass(commandBuffer, false);
+      recordDraws(commandBuffer, 0, drawList.size());
+    }
+
+    if (dynamicRendering) {
+      cmdEndRendering(commandBuffer);
+    } else {
+      vkCmdEndRenderPass(commandBuffer);
+    }
+
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentFrame * 2 + 1);
+    }
+  }
+
+  // Starts rendering into the swap chain image and the depth image, either
+  //  through the render pass and framebuffer or naming the attachments directly
+  void beginMainPass(VkCommandBuffer commandBuffer, bool secondary) {
+    VkClearValue clearValues[2]{};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0}; // Farthest, every draw passes until something is nearer
+
+    if (dynamicRendering) {
+      // Load and store operations and layouts the render pass would hold.
+      //  The render graph has already moved the images into these layouts
+      VkRenderingAttachmentInfo colorAttachment{};
+      colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+      colorAttachment.imageView = swapChainImageViews[recordingImageIndex];
+      colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+      colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+      colorAttachment.clearValue = clearValues[0];
+
+      VkRenderingAttachmentInfo depthAttachment{};
+      depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+      depthAttachment.imageView = renderGraph.view(depthTarget);
+      depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+      depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      depthAttachment.clearValue = clearValues[1];
+
+      VkRenderingInfo renderingInfo{};
+      renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+      renderingInfo.flags = secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+      renderingInfo.renderArea.offset = {0, 0};
+      renderingInfo.renderArea.extent = swapChainExtent;
+      renderingInfo.layerCount = 1;
+      renderingInfo.colorAttachmentCount = 1;
+      renderingInfo.pColorAttachments = &colorAttachment;
+      renderingInfo.pDepthAttachment = &depthAttachment;
+
+      cmdBeginRendering(commandBuffer, &renderingInfo);
+      return;
     }
 
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
-    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    renderPassInfo.framebuffer = swapChainFramebuffers[recordingImageIndex];
     renderPassInfo.renderArea.offset = {0, 0};
     renderPassInfo.renderArea.extent = swapChainExtent;
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+  }
+
+  // Records the draws [begin, end) of the draw list along with all the state
+  //  they need, as secondary command buffers don't inherit any of it
+  void recordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end) {
+    recordDrawState(commandBuffer);
 
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    for (size_t i = begin; i < end; i++) {
+      const DrawCommand& draw = drawList[i];
+      vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(draw.constants), &draw.constants);
+      vkCmdDrawIndexed(commandBuffer, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+    }
+  }
 
+  // Binds the pipeline, frame uniforms, texture, vertex and index buffers and
+  //  sets the dynamic state, with the identity draw transform for indirect draws
+  void recordDrawState(VkCommandBuffer commandBuffer) {
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    VkDescriptorSet descriptorSets[] = {frameDescriptorSet, bindless ? bindlessHeap.set() : textureDescriptorSet};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, descriptorSets, 1, &frameUniformOffset);
+    DrawPushConstants identity = {{0.0f, 0.0f}, 1.0f, 0.0f, bindless ? bindlessTextureIndex(quadTexture) : 0};
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(identity), &identity);
 
     VkViewport viewport{};
     viewport.x = 0.0f;
@@ -712,30 +2638,653 @@ private:
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    // The quad's vertices, then every instance stream out of this frame's instance buffer
+    auto streamOffsets = InstanceStreams::getStreamOffsets(instances.size());
+    VkBuffer vertexBuffers[] = {vertexBuffer, instanceBuffers[currentFrame], instanceBuffers[currentFrame], instanceBuffers[currentFrame]};
+    VkDeviceSize offsets[] = {0, streamOffsets[0], streamOffsets[1], streamOffsets[2]};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 4, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+  }
+
+  // Clears this frame's draw count before culling appends to it
+  void recordCullClear(VkCommandBuffer commandBuffer) {
+    // Without a count buffer every command gets drawn, so culled ones have to be zeroed
+    vkCmdFillBuffer(commandBuffer, indirectCountBuffers[currentFrame], 0, VK_WHOLE_SIZE, 0);
+    if (!drawIndirectCountSupported) {
+      vkCmdFillBuffer(commandBuffer, indirectBuffers[currentFrame], 0, VK_WHOLE_SIZE, 0);
+    }
+  }
 
-    vkCmdEndRenderPass(commandBuffer);
+  // Culls every object against the frustum, writing the draw commands of the
+  //  visible ones
+  void recordCulling(VkCommandBuffer commandBuffer) {
+    // Frustum planes out of the rows of the view projection matrix, for a
+    //  0 <= z <= 1 clip volume. Normalized, so the shader can compare
+    //  distances against sphere radii
+    const float* m = frameUniforms.viewProjection;
+    auto row = [m](int r, int c) {return m[c * 4 + r];};
+    CullPushConstants pushConstants{};
+    for (int c = 0; c < 4; c++) {
+      pushConstants.planes[0][c] = row(3, c) + row(0, c); // Left
+      pushConstants.planes[1][c] = row(3, c) - row(0, c); // Right
+      pushConstants.planes[2][c] = row(3, c) + row(1, c); // Top
+      pushConstants.planes[3][c] = row(3, c) - row(1, c); // Bottom
+      pushConstants.planes[4][c] = row(2, c); // Near
+      pushConstants.planes[5][c] = row(3, c) - row(2, c); // Far
+    }
+    for (auto& plane : pushConstants.planes) {
+      float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+      for (float& value : plane) {
+        value /= length;
+      }
+    }
+    pushConstants.objectCount = cullObjectCount;
+
+    // This frame's buffers, in a set that lives until the frame in flight comes around again
+    VkDescriptorSet descriptorSet = frameDescriptorAllocators[currentFrame].allocate(cullDescriptorSetLayout);
+
+    std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+    bufferInfos[0] = {objectBuffer, 0, sizeof(CullObject) * cullObjectCount};
+    // The offsets stream comes first in the instance buffer, createInstanceBuffers checked its alignment
+    bufferInfos[1] = {instanceBuffers[currentFrame], InstanceStreams::getStreamOffsets(instances.size())[0], sizeof(Vec2) * cullObjectCount};
+    bufferInfos[2] = {indirectBuffers[currentFrame], 0, sizeof(VkDrawIndexedIndirectCommand) * cullObjectCount};
+    bufferInfos[3] = {indirectCountBuffers[currentFrame], 0, sizeof(uint32_t)};
+
+    std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+    for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+      descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[binding].dstSet = descriptorSet;
+      descriptorWrites[binding].dstBinding = binding;
+      descriptorWrites[binding].dstArrayElement = 0;
+      descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      descriptorWrites[binding].descriptorCount = 1;
+      descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer!");
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (cullObjectCount + 63) / 64, 1, 1); // 64 threads per workgroup, as in cull.comp
+  }
+
+  // Splits the draw list evenly over the recording contexts, a job per
+  //  slice resetting its command pool of the current frame and recording it
+  void recordSecondaryCommandBuffers(VkFramebuffer framebuffer) {
+    size_t sliceCount = recordingContexts[currentFrame].size();
+    auto recordSlices = [this, framebuffer, sliceCount](size_t firstSlice, size_t endSlice) {
+      for (size_t slice = firstSlice; slice < endSlice; slice++) {
+        recordSlice(framebuffer, slice, sliceCount);
+      }
+    };
+    JobCounter recorded;
+    jobs->parallelFor(sliceCount, 1, recordSlices, recorded);
+    jobs->wait(recorded);
+  }
+
+  void recordSlice(VkFramebuffer framebuffer, size_t slice, size_t sliceCount) {
+    RecordingContext& context = recordingContexts[currentFrame][slice];
+    // The frame's fence was waited on, so its previous recording is done with
+    vkResetCommandPool(device, context.commandPool, 0);
+
+    // Secondary command buffers continuing a render pass name its subpass and framebuffer
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = framebuffer;
+
+    // Without a render pass they name the attachment formats instead
+    VkCommandBufferInheritanceRenderingInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &swapChainImageFormat;
+    renderingInfo.depthAttachmentFormat = depthFormat;
+    renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    if (dynamicRendering) {
+      inheritanceInfo.pNext = &renderingInfo;
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(context.commandBuffer, &beginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording secondary command buffer!");
+    }
+
+    size_t begin = drawList.size() * slice / sliceCount;
+    size_t end = drawList.size() * (slice + 1) / sliceCount;
+    recordDraws(context.commandBuffer, begin, end);
+
+    if (vkEndCommandBuffer(context.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record secondary command buffer!");
+    }
+  }
+
+  // Renders BENCHMARK_INSTANCE_FRAMES frames each for 1k, 10k, 100k and 1M
+  //  instances, or up to the instance count given when that is higher, and
+  //  reports the CPU and GPU frame times of each
+  void benchmarkInstances() {
+    std::vector<uint32_t> instanceCounts;
+    uint32_t maxInstances = std::max(options.instanceCount, 1000000u);
+    for (uint32_t count = 1000; count <= maxInstances; count *= 10) {
+      instanceCounts.push_back(count);
+    }
+
+    std::cout << "rendering " << BENCHMARK_INSTANCE_FRAMES << " frames per instance count, in "
+              << options.drawCount << " draw(s)" << std::endl;
+
+    for (uint32_t instanceCount : instanceCounts) {
+      // Nothing may still use the instance buffers being replaced
+      vkDeviceWaitIdle(device);
+      destroyInstanceBuffers();
+      createInstances(std::max(instanceCount, options.drawCount));
+      createInstanceBuffers();
+      createDrawList();
+      if (gpuCulling) {
+        destroyCullingBuffers();
+        createCullingBuffers();
+      }
+
+      frameStats.clear();
+      for (uint32_t i = 0; i < BENCHMARK_INSTANCE_FRAMES; i++) {
+        if (!options.headless) {
+          if (glfwWindowShouldClose(window)) {break;}
+          glfwPollEvents();
+        }
+        drawFrame();
+      }
+
+      // Pick up the GPU times of the last frames
+      vkDeviceWaitIdle(device);
+      for (uint32_t i = 0; i < options.framesInFlight; i++) {
+        collectGpuTimestamps(i);
+      }
+
+      double frameMs = frameStats.percentile(&FrameTimings::frameMs, 50);
+      double gpuMs = frameStats.percentile(&FrameTimings::gpuMs, 50);
+      double updateMs = frameStats.percentile(&FrameTimings::updateMs, 50);
+      std::cout << "  " << instanceCount << " instances: frame p50 " << frameMs << " ms, gpu p50 " << gpuMs
+                << " ms, update p50 " << updateMs << " ms" << std::endl;
+
+      std::string suffix = "_instances_" + std::to_string(instanceCount);
+      frameStats.setMetric("frame_ms_p50" + suffix, frameMs);
+      frameStats.setMetric("gpu_ms_p50" + suffix, gpuMs);
+      frameStats.setMetric("update_ms_p50" + suffix, updateMs);
+    }
+
+    reportFrameStats();
+  }
+
+  // Compiles every combination of blending, culling, topology, front face and
+  //  supported sample count, once on a single thread and once as jobs on
+  //  options.pipelineThreads threads, each time into a fresh pipeline cache so
+  //  neither run profits from the other. Every permutation is requested twice,
+  //  the registry only builds it once
+  void benchmarkPipelines() {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::vector<VkSampleCountFlagBits> sampleCounts;
+    for (VkSampleCountFlagBits samples : {VK_SAMPLE_COUNT_1_BIT, VK_SAMPLE_COUNT_2_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_8_BIT}) {
+      if (deviceProperties.limits.framebufferColorSampleCounts & deviceProperties.limits.framebufferDepthSampleCounts & samples) {
+        sampleCounts.push_back(samples);
+      }
+    }
+
+    // Pipelines are built against a render pass per sample count
+    std::vector<VkRenderPass> renderPasses;
+    for (VkSampleCountFlagBits samples : sampleCounts) {
+      renderPasses.push_back(makeRenderPass(swapChainImageFormat, depthFormat, samples));
+    }
+
+    std::vector<PipelineDesc> permutations;
+    for (size_t pass = 0; pass < renderPasses.size(); pass++) {
+      // No point lists, shader.vert doesn't write gl_PointSize, which they need
+      for (VkPrimitiveTopology topology : {VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+                                           VK_PRIMITIVE_TOPOLOGY_LINE_LIST}) {
+        for (VkCullModeFlags cullMode : {VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_FRONT_AND_BACK}) {
+          for (VkFrontFace frontFace : {VK_FRONT_FACE_CLOCKWISE, VK_FRONT_FACE_COUNTER_CLOCKWISE}) {
+            for (bool blendEnable : {false, true}) {
+              PipelineDesc desc = makePipelineDesc(renderPasses[pass]);
+              desc.samples = sampleCounts[pass];
+              desc.topology = topology;
+              desc.cullMode = cullMode;
+              desc.frontFace = frontFace;
+              desc.blendEnable = blendEnable;
+              permutations.push_back(desc);
+            }
+          }
+        }
+      }
+    }
+
+    // Without workers every job runs on this thread, as it waits. The app's
+    //  job system runs the parallel pass, unless --pipeline-threads asks for
+    //  another thread count, this thread counting as one of them
+    JobSystem serialJobs(0);
+    std::unique_ptr<JobSystem> sizedJobs;
+    if (options.pipelineThreads > 0) {
+      sizedJobs = std::make_unique<JobSystem>(options.pipelineThreads - 1);
+    }
+    JobSystem& parallelJobs = sizedJobs ? *sizedJobs : *jobs;
+    uint32_t maxThreads = parallelJobs.workerCount() + 1;
+    std::cout << "compiling " << permutations.size() << " pipeline permutations" << std::endl;
+
+    double singleMs = 0.0;
+    for (JobSystem* compileJobs : {&serialJobs, &parallelJobs}) {
+      uint32_t threadCount = compileJobs->workerCount() + 1;
+      VkPipelineCacheCreateInfo cacheInfo{};
+      cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+      VkPipelineCache benchmarkCache;
+      if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &benchmarkCache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+      }
+
+      PipelineRegistry registry;
+      registry.init(device, benchmarkCache);
+      for (uint32_t copy = 0; copy < 2; copy++) {
+        for (const PipelineDesc& desc : permutations) {
+          registry.request(desc);
+        }
+      }
+
+      double wallMs = registry.compile(*compileJobs);
+      std::cout << threadCount << " thread(s):" << std::endl;
+      registry.printReport(std::cout, wallMs);
+      if (threadCount == 1) {
+        singleMs = wallMs;
+      } else {
+        std::cout << "  " << singleMs / wallMs << "x single threaded" << std::endl;
+      }
+      frameStats.setMetric("pipeline_compile_ms_threads_" + std::to_string(threadCount), wallMs);
+
+      registry.destroy();
+      vkDestroyPipelineCache(device, benchmarkCache, nullptr);
+      if (maxThreads == 1) {break;}
+    }
+    frameStats.setMetric("pipeline_permutations", static_cast<double>(permutations.size()));
+
+    for (VkRenderPass pass : renderPasses) {
+      vkDestroyRenderPass(device, pass, nullptr);
+    }
+
+    reportFrameStats();
+  }
+
+  // Records the first frame over and over, inline and then split into 1, 2,
+  //  4, ... secondary command buffers up to the threads the job system
+  //  records on, and reports the time per frame. Nothing is submitted, so
+  //  the command buffers can be reset right away
+  void benchmarkRecording() {
+    std::vector<uint32_t> sliceCounts = {0};
+    uint32_t maxSlices = jobs->workerCount() + 1; // The main thread records too
+    for (uint32_t count = 1; count < maxSlices; count *= 2) {
+      sliceCounts.push_back(count);
+    }
+    sliceCounts.push_back(maxSlices);
+
+    // Frames recorded below are never submitted, so render until every
+    //  texture upload went out, they would be lost otherwise
+    while (textures.pendingUploads() > 0) {
+      drawFrame();
+    }
+    vkDeviceWaitIdle(device);
+
+    std::cout << "recording " << drawList.size() << " draws, " << BENCHMARK_RECORD_ITERATIONS << " frames per slice count" << std::endl;
+
+    double inlineMs = 0.0;
+    for (uint32_t sliceCount : sliceCounts) {
+      createRecordingContexts(sliceCount);
+
+      // Let the pools grow to their steady state size before timing
+      for (uint32_t i = 0; i < 10; i++) {
+        vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+        recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+      }
+
+      double totalMs = 0.0;
+      {
+        ScopedTimer timer(totalMs);
+        for (uint32_t i = 0; i < BENCHMARK_RECORD_ITERATIONS; i++) {
+          vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+          recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+        }
+      }
+      double frameMs = totalMs / BENCHMARK_RECORD_ITERATIONS;
+
+      if (sliceCount == 0) {
+        inlineMs = frameMs;
+        std::cout << "  inline: " << frameMs << " ms per frame" << std::endl;
+        frameStats.setMetric("record_ms_inline", frameMs);
+      } else {
+        std::cout << "  " << sliceCount << " slices: " << frameMs << " ms per frame, "
+                  << inlineMs / frameMs << "x inline" << std::endl;
+        frameStats.setMetric("record_ms_slices_" + std::to_string(sliceCount), frameMs);
+      }
+    }
+
+    // Back to the slice count the application was started with
+    createRecordingContexts(options.recordThreads);
+
+    vkDeviceWaitIdle(device);
+    reportFrameStats();
+  }
+
+  // Rebuilds what depends on the swap chain images and records the first
+  //  frame over and over, with render pass objects and then with dynamic
+  //  rendering, and reports the time each takes. Nothing is submitted
+  void benchmarkRendering() {
+    if (!dynamicRenderingSupported) {
+      throw std::runtime_error("dynamic rendering is not supported, there is nothing to compare against!");
+    }
+
+    // Frames recorded below are never submitted, so render until every
+    //  texture upload went out, they would be lost otherwise
+    while (textures.pendingUploads() > 0) {
+      drawFrame();
+    }
+    vkDeviceWaitIdle(device);
+
+    std::cout << "rebuilding swap chain targets " << BENCHMARK_RECREATE_ITERATIONS << " times and recording "
+              << drawList.size() << " draws " << BENCHMARK_RECORD_ITERATIONS << " times per render path" << std::endl;
+
+    bool startedDynamic = dynamicRendering;
+    double renderPassRecordMs = 0.0;
+    for (bool dynamic : {false, true}) {
+      setRenderingMode(dynamic);
+
+      // What recreateSwapChain rebuilds once the swap chain itself is
+      //  recreated. The device is idle, so retired objects go right away
+      double recreateMs = 0.0;
+      {
+        ScopedTimer timer(recreateMs);
+        for (uint32_t i = 0; i < BENCHMARK_RECREATE_ITERATIONS; i++) {
+          cleanupSwapChain();
+          deletionQueue.flush();
+          createImageViews();
+          createRenderGraph();
+          createFrameBuffers();
+        }
+      }
+      recreateMs /= BENCHMARK_RECREATE_ITERATIONS;
+
+      for (uint32_t i = 0; i < 10; i++) {
+        vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+        recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+      }
+
+      double recordMs = 0.0;
+      {
+        ScopedTimer timer(recordMs);
+        for (uint32_t i = 0; i < BENCHMARK_RECORD_ITERATIONS; i++) {
+          vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+          recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+        }
+      }
+      recordMs /= BENCHMARK_RECORD_ITERATIONS;
+
+      std::string name = dynamic ? "dynamic" : "render_pass";
+      std::cout << "  " << (dynamic ? "dynamic rendering" : "render pass") << ": " << recreateMs << " ms per recreation, "
+                << recordMs << " ms per frame";
+      if (dynamic) {
+        std::cout << ", " << renderPassRecordMs / recordMs << "x render pass";
+      } else {
+        renderPassRecordMs = recordMs;
+      }
+      std::cout << std::endl;
+      frameStats.setMetric("rendering_recreate_ms_" + name, recreateMs);
+      frameStats.setMetric("rendering_record_ms_" + name, recordMs);
+    }
+
+    // Back to the path the application was started with
+    setRenderingMode(startedDynamic);
+
+    vkDeviceWaitIdle(device);
+    reportFrameStats();
+  }
+
+  // Starts BENCHMARK_JOB_COUNT jobs doing next to nothing and waits for
+  //  them, BENCHMARK_JOB_ROUNDS times each way: through the job system with
+  //  run, which allocates a copy of every job, and with parallelFor, which
+  //  allocates nothing, and then as std::async tasks. The time per job is
+  //  what scheduling costs, as the jobs themselves take no time
+  void benchmarkJobs() {
+    std::cout << "starting " << BENCHMARK_JOB_COUNT << " jobs " << BENCHMARK_JOB_ROUNDS << " times each way, "
+              << jobs->workerCount() << " worker thread(s)" << std::endl;
+
+    std::atomic<uint32_t> jobsRun{0};
+    auto job = [&jobsRun] {jobsRun.fetch_add(1, std::memory_order_relaxed);};
+    auto jobRange = [&jobsRun](size_t begin, size_t end) {
+      jobsRun.fetch_add(static_cast<uint32_t>(end - begin), std::memory_order_relaxed);
+    };
+
+    double runMs = 0.0;
+    double parallelForMs = 0.0;
+    double asyncMs = 0.0;
+    std::vector<std::future<void>> futures;
+    futures.reserve(BENCHMARK_JOB_COUNT);
+    for (uint32_t round = 0; round < BENCHMARK_JOB_ROUNDS; round++) {
+      {
+        ScopedTimer timer(runMs);
+        JobCounter counter;
+        for (uint32_t i = 0; i < BENCHMARK_JOB_COUNT; i++) {
+          jobs->run(job, counter);
+        }
+        jobs->wait(counter);
+      }
+      {
+        ScopedTimer timer(parallelForMs);
+        JobCounter counter;
+        jobs->parallelFor(BENCHMARK_JOB_COUNT, 1, jobRange, counter);
+        jobs->wait(counter);
+      }
+      {
+        ScopedTimer timer(asyncMs);
+        for (uint32_t i = 0; i < BENCHMARK_JOB_COUNT; i++) {
+          futures.push_back(std::async(std::launch::async, job));
+        }
+        for (std::future<void>& future : futures) {
+          future.get();
+        }
+        futures.clear();
+      }
+    }
+    if (jobsRun != 3 * BENCHMARK_JOB_COUNT * BENCHMARK_JOB_ROUNDS) {
+      throw std::runtime_error("benchmark jobs went missing!");
+    }
+
+    // Microseconds per job
+    double jobCount = static_cast<double>(BENCHMARK_JOB_COUNT) * BENCHMARK_JOB_ROUNDS;
+    double runUs = runMs * 1000.0 / jobCount;
+    double parallelForUs = parallelForMs * 1000.0 / jobCount;
+    double asyncUs = asyncMs * 1000.0 / jobCount;
+    std::cout << "  job system run: " << runUs << " us per job, " << asyncUs / runUs << "x std::async" << std::endl;
+    std::cout << "  job system parallelFor: " << parallelForUs << " us per job, " << asyncUs / parallelForUs << "x std::async" << std::endl;
+    std::cout << "  std::async: " << asyncUs << " us per job" << std::endl;
+    frameStats.setMetric("job_run_us", runUs);
+    frameStats.setMetric("job_parallel_for_us", parallelForUs);
+    frameStats.setMetric("job_async_us", asyncUs);
+
+    reportFrameStats();
+  }
+
+  // Switches between render pass objects and dynamic rendering, rebuilding
+  //  the render pass, graphics pipeline and framebuffers for the new path
+  void setRenderingMode(bool dynamic) {
+    vkDeviceWaitIdle(device);
+
+    {
+      // A shader reload may be building against the render pass and layout
+      std::lock_guard<std::mutex> lock(buildMutex);
+      deletionQueue.retire(PipelineHandle(device, pipelines.release(graphicsPipelineDesc)));
+      deletionQueue.retire(std::move(pipelineLayout));
+      deletionQueue.retire(std::move(renderPass));
+      dynamicRendering = dynamic;
+      createRenderPass();
+      createGraphicsPipeline();
+    }
+
+    cleanupSwapChain();
+    deletionQueue.flush();
+    createImageViews();
+    createRenderGraph();
+    createFrameBuffers();
+  }
+
+  // Creates a buffer backed by a range sub-allocated from allocator
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, GpuAllocation& allocation) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create buffer!");
     }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    allocation = allocator.allocate(memRequirements, properties, GpuResourceKind::Linear);
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+  }
+
+  void destroyBuffer(VkBuffer& buffer, GpuAllocation& allocation) {
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator.free(allocation);
+    buffer = VK_NULL_HANDLE;
+  }
+
+  // Allocates and begins a command buffer for a one off submission
+  VkCommandBuffer beginSingleTimeCommands() {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+  }
+
+  // Ends, submits and frees a command buffer from beginSingleTimeCommands,
+  //  waiting for the graphics queue to finish it
+  void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+
+    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(graphicsQueue);
+
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
   }
 
-  // Take SPIR-V Binary buffer to make shader module
-  VkShaderModule createShaderModule(const std::vector<char>& code) {
-    // Creation info for shader module
-    VkShaderModuleCreateInfo createInfo{};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = code.size();
-    // Code inserted as reinterpret_casted integers
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  // Copies a rendered headless image back to the host and writes it as a binary PPM
+  void saveImage(VkImage image, const std::string& filename) {
+    VkDeviceSize imageSize = static_cast<VkDeviceSize>(swapChainExtent.width) * swapChainExtent.height * 4;
+
+    // Host visible buffer the image gets copied into
+    VkBuffer readbackBuffer;
+    GpuAllocation readbackAllocation;
+    createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        readbackBuffer, readbackAllocation);
+
+    // The render pass leaves the image in TRANSFER_SRC_OPTIMAL when headless,
+    //  the color writes still need to be made visible to the copy
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0; // Tightly packed
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+    // Make the transfer write visible to the host read below
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = readbackBuffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    endSingleTimeCommands(commandBuffer);
+
+    // Write RGBA pixels out as RGB
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+      destroyBuffer(readbackBuffer, readbackAllocation);
+      throw std::runtime_error("failed to open output image file!");
+    }
+    file << "P6\n" << swapChainExtent.width << " " << swapChainExtent.height << "\n255\n";
 
-    VkShaderModule shaderModule;
-    if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create shader module!");
+    // Host visible allocations stay mapped
+    const unsigned char* pixels = static_cast<const unsigned char*>(readbackAllocation.mapped);
+    for (VkDeviceSize i = 0; i < imageSize; i += 4) {
+      file.write(reinterpret_cast<const char*>(pixels + i), 3);
     }
 
-    return shaderModule;
+    file.close();
+
+    destroyBuffer(readbackBuffer, readbackAllocation);
+  }
+
+  // Get the shader module for a SPIR-V file, owned by shaderModules
+  VkShaderModule createShaderModule(const std::string& filename) {
+    return shaderModules.get(loadShader(filename));
+  }
+
+  // Loads SPIR-V from the copy embedded at build time, or maps it from disk
+  SpirvBlob loadShader(const std::string& filename) {
+#ifdef EMBED_SHADERS
+    for (const EmbeddedShader& shader : embeddedShaders) {
+      if (filename == shader.path) {
+        return SpirvBlob::fromMemory(shader.code, shader.size, filename);
+      }
+    }
+#endif
+    return SpirvBlob::fromFile(filename);
   }
 
   VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -814,47 +3363,91 @@ private:
     return details;
   }
 
-  int rateDeviceSuitability(VkPhysicalDevice device) {
-    // Variables hold device info
-    VkPhysicalDeviceProperties deviceProperties;
-    VkPhysicalDeviceFeatures deviceFeatures;
-    // Getting device info through API
-    vkGetPhysicalDeviceProperties(device, &deviceProperties);
-    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-
-    // ## Scoring section
-    QueueFamilyIndices indices = findQueueFamilies(device);
-    int score = 0;
-
-    // Discrete GPUs have a significant performance advantage
-    if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-      score += 1000;
+  // Features the options ask for. Devices lacking a required one are
+  //  unsuitable, optional ones fall back to a path that does without
+  struct FeatureRequest {
+    DeviceFeature feature;
+    bool required;
+  };
+
+  std::vector<FeatureRequest> requestedFeatures(VkPhysicalDevice device) {
+    std::vector<FeatureRequest> requests = {{DeviceFeature::TimelineSemaphore, false}};
+    if (options.gpuCulling && graphicsFamilySupportsCompute(device)) {
+      requests.push_back({DeviceFeature::MultiDrawIndirect, false});
+      requests.push_back({DeviceFeature::DrawIndirectCount, false});
+    }
+    if (options.dynamicRendering || options.benchmarkRendering) {
+      // There is nothing to compare render passes against without it
+      requests.push_back({DeviceFeature::DynamicRendering, options.benchmarkRendering});
+    }
+    if (options.bindless) {
+      requests.push_back({DeviceFeature::DescriptorIndexing, false});
     }
+    return requests;
+  }
 
-    // Max possible texture size affects graphics quality
-    score += deviceProperties.limits.maxImageDimension2D;
+  int rateDeviceSuitability(VkPhysicalDevice device) {
+    DeviceCapabilities capabilities;
+    capabilities.query(device);
+    QueueFamilyIndices indices = findQueueFamilies(device);
 
     // Check if extensions are supported on this device
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    // Check if the swapChain on this device is adequate
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    // Check if the swapChain on this device is adequate, anything goes when headless
+    bool swapChainAdequate = options.headless;
+    if (extensionsSupported && !options.headless) {
       SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
       swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
-    // Application can't function without geometry support, all families available,
-    //  extension support, and an adequate swap chain
-    if ( !(deviceFeatures.geometryShader && indices.isComplete() &&
-        extensionsSupported && swapChainAdequate) ) {
+    // Application can't function without all families available, extension
+    //  support and an adequate swap chain
+    if ( !(indices.isComplete() && extensionsSupported && swapChainAdequate) ) {
       return 0;
     }
 
+    // ## Scoring section
+    // The kind of device matters most, CPU implementations such as lavapipe
+    //  still qualify but only when nothing else does
+    int score = 1;
+    switch (capabilities.properties().deviceType) {
+      case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 100000; break;
+      case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 50000; break;
+      case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 25000; break;
+      default: break;
+    }
+
+    // Then the device local memory, a point per 64 MiB, and a transfer queue
+    //  copying alongside rendering
+    score += static_cast<int>(capabilities.deviceLocalBytes() >> 26);
+    if (indices.transferFamily.has_value()) {
+      score += 1000;
+    }
+
+    // And every requested feature that won't have to fall back
+    for (const FeatureRequest& request : requestedFeatures(device)) {
+      if (capabilities.supports(request.feature)) {
+        score += 2000;
+      } else if (request.required) {
+        return 0;
+      }
+    }
+
     return score;
   }
 
-  // Used to check if device can present to screen (so far)
+  // The culling shader runs on the graphics queue, right before the draws it feeds
+  bool graphicsFamilySupportsCompute(VkPhysicalDevice device) {
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    uint32_t graphicsFamily = findQueueFamilies(device).graphicsFamily.value();
+    return (queueFamilies[graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+  }
+
   bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
     // Get extensionCount
     uint32_t extensionCount; // to be filled
@@ -868,7 +3461,8 @@ private:
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
     // Lists requiredExtensions to be checked if available
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    std::vector<const char*> extensions = getRequiredDeviceExtensions();
+    std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
     // Removes availableExtensions from requiredExtensions
     //  means all extensions are found if requiredExtensions is empty
@@ -899,6 +3493,12 @@ private:
       if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
         indices.graphicsFamily = i;
 
+        // Nothing gets presented when headless, the graphics family stands in
+        if (options.headless) {
+          indices.presentFamily = i;
+          break;
+        }
+
         // Get presentSupport from device
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
@@ -913,17 +3513,34 @@ private:
       i++;
     }
 
+    // A family that only does transfers is usually backed by a DMA engine that
+    //  copies alongside rendering, take one without compute as well if possible
+    for (uint32_t family = 0; family < queueFamilies.size(); family++) {
+      VkQueueFlags flags = queueFamilies[family].queueFlags;
+      if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+        continue;
+      }
+      if (!indices.transferFamily.has_value() || !(flags & VK_QUEUE_COMPUTE_BIT)) {
+        indices.transferFamily = family;
+      }
+    }
+
     return indices;
   }
 
   // Gets list of required extensions, adding debug utils if 
   //  validation layers are enabled
   std::vector<const char*> getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char*> extensions;
+
+    // GLFW's surface extensions are only needed with a window
+    if (!options.headless) {
+      uint32_t glfwExtensionCount = 0;
+      const char** glfwExtensions;
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+      extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers) {
       extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -932,6 +3549,15 @@ private:
     return extensions;
   }
 
+  // Gets list of required device extensions, headless runs don't need a swapchain
+  std::vector<const char*> getRequiredDeviceExtensions() {
+    if (options.headless) {
+      return {};
+    }
+
+    return deviceExtensions;
+  }
+
   bool checkValidationLayerSupport() {
     // Holds layer count
     uint32_t layerCount;
@@ -1004,10 +3630,108 @@ private:
 
 };
 
-int main() {
-  HelloTriangleApplication app;
+// Parses the command line into AppOptions, throwing on unknown or malformed arguments
+AppOptions parseOptions(int argc, char* argv[]) {
+  AppOptions options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if (arg == "--frames-in-flight" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 1) {
+        throw std::runtime_error("--frames-in-flight must be at least 1!");
+      }
+      options.framesInFlight = static_cast<uint32_t>(value);
+    } else if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 0) {
+        throw std::runtime_error("--frames must not be negative!");
+      }
+      options.maxFrames = static_cast<uint32_t>(value);
+    } else if (arg == "--output" && i + 1 < argc) {
+      options.outputPath = argv[++i];
+    } else if (arg == "--pipeline-cache" && i + 1 < argc) {
+      options.pipelineCachePath = argv[++i];
+    } else if (arg == "--stats-csv" && i + 1 < argc) {
+      options.statsCsvPath = argv[++i];
+    } else if (arg == "--stats-json" && i + 1 < argc) {
+      options.statsJsonPath = argv[++i];
+    } else if (arg == "--instances" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 1) {
+        throw std::runtime_error("--instances must be at least 1!");
+      }
+      options.instanceCount = static_cast<uint32_t>(value);
+    } else if (arg == "--draws" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 1) {
+        throw std::runtime_error("--draws must be at least 1!");
+      }
+      options.drawCount = static_cast<uint32_t>(value);
+    } else if (arg == "--record-threads" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 0) {
+        throw std::runtime_error("--record-threads must not be negative!");
+      }
+      options.recordThreads = static_cast<uint32_t>(value);
+    } else if (arg == "--benchmark-recording") {
+      options.benchmarkRecording = true;
+    } else if (arg == "--benchmark-instances") {
+      options.benchmarkInstances = true;
+    } else if (arg == "--gpu-culling") {
+      options.gpuCulling = true;
+    } else if (arg == "--benchmark-pipelines") {
+      options.benchmarkPipelines = true;
+    } else if (arg == "--pipeline-threads" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 0) {
+        throw std::runtime_error("--pipeline-threads must not be negative!");
+      }
+      options.pipelineThreads = static_cast<uint32_t>(value);
+    } else if (arg == "--watch-shaders") {
+#ifdef EMBED_SHADERS
+      throw std::runtime_error("--watch-shaders needs the shaders directory, it doesn't work with embedded shaders!");
+#endif
+      options.watchShaders = true;
+    } else if (arg == "--stream-textures") {
+      options.streamTextures = true;
+    } else if (arg == "--dynamic-rendering") {
+      options.dynamicRendering = true;
+    } else if (arg == "--benchmark-rendering") {
+      options.benchmarkRendering = true;
+    } else if (arg == "--bindless") {
+      options.bindless = true;
+    } else if (arg == "--job-threads" && i + 1 < argc) {
+      int value = std::atoi(argv[++i]);
+      if (value < 0) {
+        throw std::runtime_error("--job-threads must not be negative!");
+      }
+      options.jobThreads = static_cast<uint32_t>(value);
+    } else if (arg == "--benchmark-jobs") {
+      options.benchmarkJobs = true;
+    } else {
+      throw std::runtime_error("unknown argument: " + arg);
+    }
+  }
+
+  // Headless runs can't be closed by hand, so render a single frame unless told otherwise
+  if (options.headless && options.maxFrames == 0) {
+    options.maxFrames = 1;
+  }
+
+  if (!options.outputPath.empty() && !options.headless) {
+    throw std::runtime_error("--output is only supported together with --headless!");
+  }
+
+  return options;
+}
 
+int main(int argc, char* argv[]) {
   try {
+      HelloTriangleApplication app(parseOptions(argc, argv));
       app.run();
   } catch (const std::exception& e) {
       std::cerr << e.what() << std::endl;
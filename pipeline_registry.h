@@ -0,0 +1,356 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "job_system.h"
+
+// Everything that tells one graphics pipeline apart from another. Viewport
+//  and scissor are dynamic, so they are not part of it
+struct PipelineDesc {
+  VkShaderModule vertexShader = VK_NULL_HANDLE;
+  VkShaderModule fragmentShader = VK_NULL_HANDLE;
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  bool blendEnable = false; // Standard alpha blending when enabled
+  bool depthTest = false; // Needs a render pass with a depth attachment
+  bool depthWrite = false;
+  VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkRenderPass renderPass = VK_NULL_HANDLE; // VK_NULL_HANDLE for dynamic rendering into the formats below
+  uint32_t subpass = 0;
+  VkFormat colorFormat = VK_FORMAT_UNDEFINED; // Attachment formats when rendering dynamically
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+
+  bool operator==(const PipelineDesc& other) const {
+    return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+        bindings.size() == other.bindings.size() &&
+        std::equal(bindings.begin(), bindings.end(), other.bindings.begin(), [](const auto& a, const auto& b) {
+          return a.binding == b.binding && a.stride == b.stride && a.inputRate == b.inputRate;
+        }) &&
+        attributes.size() == other.attributes.size() &&
+        std::equal(attributes.begin(), attributes.end(), other.attributes.begin(), [](const auto& a, const auto& b) {
+          return a.location == b.location && a.binding == b.binding && a.format == b.format && a.offset == b.offset;
+        }) &&
+        topology == other.topology && polygonMode == other.polygonMode && cullMode == other.cullMode &&
+        frontFace == other.frontFace && samples == other.samples && blendEnable == other.blendEnable &&
+        depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompareOp == other.depthCompareOp &&
+        layout == other.layout && renderPass == other.renderPass && subpass == other.subpass &&
+        colorFormat == other.colorFormat && depthFormat == other.depthFormat;
+  }
+
+  bool operator!=(const PipelineDesc& other) const {return !(*this == other);}
+
+  size_t hash() const {
+    size_t value = 0;
+    auto combine = [&value](uint64_t field) {
+      value ^= std::hash<uint64_t>()(field) + 0x9e3779b97f4a7c15ULL + (value << 6) + (value >> 2);
+    };
+
+    combine(reinterpret_cast<uint64_t>(vertexShader));
+    combine(reinterpret_cast<uint64_t>(fragmentShader));
+    for (const auto& binding : bindings) {
+      combine(binding.binding);
+      combine(binding.stride);
+      combine(binding.inputRate);
+    }
+    for (const auto& attribute : attributes) {
+      combine(attribute.location);
+      combine(attribute.binding);
+      combine(attribute.format);
+      combine(attribute.offset);
+    }
+    combine(topology);
+    combine(polygonMode);
+    combine(cullMode);
+    combine(frontFace);
+    combine(samples);
+    combine(blendEnable);
+    combine(depthTest);
+    combine(depthWrite);
+    combine(depthCompareOp);
+    combine(reinterpret_cast<uint64_t>(layout));
+    combine(reinterpret_cast<uint64_t>(renderPass));
+    combine(subpass);
+    combine(colorFormat);
+    combine(depthFormat);
+    return value;
+  }
+};
+
+struct PipelineDescHash {
+  size_t operator()(const PipelineDesc& desc) const {return desc.hash();}
+};
+
+// Owns every graphics pipeline. Descriptions are requested up front, identical
+//  ones share a pipeline, and compile() builds everything still missing as
+//  jobs, all sharing one VkPipelineCache
+class PipelineRegistry {
+public:
+  using PipelineId = uint32_t;
+
+  void init(VkDevice device, VkPipelineCache pipelineCache) {
+    this->device = device;
+    this->pipelineCache = pipelineCache;
+  }
+
+  void destroy() {
+    for (const Entry& entry : entries) {
+      if (entry.pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, entry.pipeline, nullptr);
+      }
+    }
+    entries.clear();
+    ids.clear();
+  }
+
+  // Returns the id of the description's pipeline, which is built by the next compile()
+  PipelineId request(const PipelineDesc& desc) {
+    requestCount++;
+    auto found = ids.find(desc);
+    if (found != ids.end()) {
+      return found->second;
+    }
+
+    PipelineId id = static_cast<PipelineId>(entries.size());
+    entries.push_back({desc, VK_NULL_HANDLE, 0.0, false});
+    ids.emplace(desc, id);
+    return id;
+  }
+
+  // Builds every requested pipeline that doesn't exist yet, a job each on
+  //  jobs, and rethrows the first error. Returns the wall clock time taken
+  //  in milliseconds
+  double compile(JobSystem& jobs) {
+    std::vector<PipelineId> pending;
+    for (PipelineId id = 0; id < entries.size(); id++) {
+      if (entries[id].pipeline == VK_NULL_HANDLE && !entries[id].evicted) {
+        pending.push_back(id);
+      }
+    }
+    if (pending.empty()) {
+      return 0.0;
+    }
+
+    auto compileStart = std::chrono::steady_clock::now();
+
+    // A job per pipeline, as some compile much slower than others and idle
+    //  threads steal whatever is left
+    auto buildRange = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        build(entries[pending[i]]);
+      }
+    };
+    JobCounter built;
+    jobs.parallelFor(pending.size(), 1, buildRange, built);
+    jobs.wait(built);
+
+    std::chrono::duration<double, std::milli> compileTime = std::chrono::steady_clock::now() - compileStart;
+    lastCompiled = pending;
+    return compileTime.count();
+  }
+
+  // Takes ownership of a pipeline built elsewhere from desc, such as one
+  //  rebuilt off the render thread. An existing pipeline for desc is kept
+  //  instead and the given one destroyed
+  PipelineId adopt(const PipelineDesc& desc, VkPipeline pipeline) {
+    auto found = ids.find(desc);
+    if (found != ids.end() && entries[found->second].pipeline != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device, pipeline, nullptr);
+      return found->second;
+    }
+
+    PipelineId id = request(desc);
+    entries[id].pipeline = pipeline;
+    return id;
+  }
+
+  VkPipeline get(PipelineId id) const {return entries[id].pipeline;}
+  double compileMs(PipelineId id) const {return entries[id].compileMs;}
+  const PipelineDesc& desc(PipelineId id) const {return entries[id].desc;}
+
+  // Removes the description's pipeline, for when something it was built
+  //  against, such as its render pass, goes away. The caller destroys the
+  //  returned pipeline once no frame in flight uses it anymore
+  VkPipeline release(const PipelineDesc& desc) {
+    auto found = ids.find(desc);
+    if (found == ids.end()) {
+      return VK_NULL_HANDLE;
+    }
+
+    Entry& entry = entries[found->second];
+    VkPipeline pipeline = entry.pipeline;
+    entry.pipeline = VK_NULL_HANDLE;
+    // The slot stays, so ids handed out before remain valid, but it is never
+    //  built again. Requesting the description again gives it a new slot
+    entry.evicted = true;
+    ids.erase(found);
+    return pipeline;
+  }
+
+  // Per pipeline times of the last compile(), then the totals
+  void printReport(std::ostream& out, double wallMs) const {
+    double sumMs = 0.0, maxMs = 0.0;
+    for (PipelineId id : lastCompiled) {
+      out << "  pipeline " << std::setw(4) << id << ": " << std::fixed << std::setprecision(3)
+          << entries[id].compileMs << " ms" << std::defaultfloat << std::endl;
+      sumMs += entries[id].compileMs;
+      maxMs = std::max(maxMs, entries[id].compileMs);
+    }
+    out << lastCompiled.size() << " pipelines compiled (" << requestCount << " requested, "
+        << requestCount - entries.size() << " deduplicated) in " << wallMs << " ms, "
+        << sumMs << " ms summed over threads, slowest " << maxMs << " ms" << std::endl;
+  }
+
+  size_t requestedCount() const {return requestCount;}
+  size_t pipelineCount() const {return entries.size();}
+
+  // Fills in the create info structs from the description and builds the
+  //  pipeline. Safe to call from any thread
+  static VkPipeline createPipeline(VkDevice device, VkPipelineCache pipelineCache, const PipelineDesc& desc) {
+    VkPipelineShaderStageCreateInfo shaderStages[2]{};
+    shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    shaderStages[0].module = desc.vertexShader;
+    shaderStages[0].pName = "main";
+    shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = desc.fragmentShader;
+    shaderStages[1].pName = "main";
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.bindings.size());
+    vertexInputInfo.pVertexBindingDescriptions = desc.bindings.data();
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.attributes.size());
+    vertexInputInfo.pVertexAttributeDescriptions = desc.attributes.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = desc.topology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = desc.polygonMode;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = desc.cullMode;
+    rasterizer.frontFace = desc.frontFace;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = desc.samples;
+    multisampling.minSampleShading = 1.0f;
+
+    // Ignored by render passes without a depth attachment
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = desc.depthCompareOp;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = desc.blendEnable ? VK_TRUE : VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstColorBlendFactor = desc.blendEnable ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY;
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    // Without a render pass the attachment formats are given directly
+    VkPipelineRenderingCreateInfo renderingInfo{};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &desc.colorFormat;
+    renderingInfo.depthAttachmentFormat = desc.depthFormat;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.pNext = desc.renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = desc.layout;
+    pipelineInfo.renderPass = desc.renderPass;
+    pipelineInfo.subpass = desc.subpass;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create graphics pipeline!");
+    }
+    return pipeline;
+  }
+
+private:
+  struct Entry {
+    PipelineDesc desc;
+    VkPipeline pipeline;
+    double compileMs; // Time vkCreateGraphicsPipelines took
+    bool evicted;
+  };
+
+  VkDevice device;
+  VkPipelineCache pipelineCache; // Internally synchronized, so all threads share it
+  std::vector<Entry> entries; // Indexed by PipelineId
+  std::unordered_map<PipelineDesc, PipelineId, PipelineDescHash> ids;
+  std::vector<PipelineId> lastCompiled;
+  size_t requestCount = 0;
+
+  // Builds the entry's pipeline and records how long it took
+  void build(Entry& entry) {
+    auto buildStart = std::chrono::steady_clock::now();
+    entry.pipeline = createPipeline(device, pipelineCache, entry.desc);
+    std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+    entry.compileMs = buildTime.count();
+  }
+};
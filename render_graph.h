@@ -0,0 +1,477 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "deletion_queue.h"
+#include "device_handle.h"
+#include "frame_arena.h"
+#include "gpu_memory.h"
+
+// How a pass uses a resource: the stages and accesses it uses it in, the
+//  layout it needs images in and whether it changes the contents
+struct ResourceUsage {
+  VkPipelineStageFlags stages;
+  VkAccessFlags access;
+  VkImageLayout layout; // VK_IMAGE_LAYOUT_UNDEFINED for buffers
+  bool writes;
+};
+
+const ResourceUsage USAGE_COLOR_ATTACHMENT = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true};
+const ResourceUsage USAGE_DEPTH_ATTACHMENT = {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true};
+const ResourceUsage USAGE_FRAGMENT_SAMPLED = {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+    VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false};
+const ResourceUsage USAGE_COMPUTE_STORAGE = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true};
+const ResourceUsage USAGE_INDIRECT_READ = {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+    VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false};
+const ResourceUsage USAGE_TRANSFER_WRITE = {VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true};
+const ResourceUsage USAGE_TRANSFER_READ = {VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false};
+// Handed to the presentation engine, which waits on a semaphore instead
+const ResourceUsage USAGE_PRESENT = {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false};
+
+// Image the graph creates and owns, only valid between the passes using it
+struct TransientImageDesc {
+  VkFormat format;
+  VkExtent2D extent;
+  VkImageUsageFlags usage;
+  VkImageAspectFlags aspect;
+};
+
+// Frame structure as passes declaring the resources they use. compile() drops
+//  passes nothing depends on, places transient images with disjoint lifetimes
+//  in the same memory and works out the barriers and layout transitions
+//  between passes once. execute() then records the passes of a frame with
+//  those barriers in between, no pass records barriers of its own
+class RenderGraph {
+public:
+  using ResourceId = uint32_t;
+
+  // A resource a pass uses. Discarding uses overwrite all of it, such as a
+  //  cleared attachment, so images start from VK_IMAGE_LAYOUT_UNDEFINED
+  struct Access {
+    ResourceId resource;
+    ResourceUsage usage;
+    bool discard = false;
+  };
+
+  void init(VkDevice device, GpuAllocator& allocator, DeletionQueue& deletionQueue) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->deletionQueue = &deletionQueue;
+  }
+
+  // Forgets every pass and resource. Transient images are retired, as frames
+  //  in flight may still use them
+  void reset() {
+    for (Resource& resource : resources) {
+      if (resource.transient && resource.image != VK_NULL_HANDLE) {
+        deletionQueue->retire(std::move(resource.view));
+        VkImage image = resource.image;
+        deletionQueue->defer([device = device, image] {vkDestroyImage(device, image, nullptr);});
+      }
+    }
+    if (memory.memory != VK_NULL_HANDLE) {
+      GpuAllocation allocation = memory;
+      GpuAllocator* owner = allocator;
+      deletionQueue->defer([owner, allocation]() mutable {owner->free(allocation);});
+      memory = {};
+    }
+    resources.clear();
+    passes.clear();
+    finalBarriers.clear();
+    unaliasedBytes = 0;
+    compiled = false;
+  }
+
+  ResourceId createImage(const std::string& name, const TransientImageDesc& desc) {
+    Resource resource;
+    resource.name = name;
+    resource.isImage = true;
+    resource.transient = true;
+    resource.desc = desc;
+    resource.aspect = desc.aspect;
+    return addResource(std::move(resource));
+  }
+
+  // An image from outside the graph, bound every frame with bindImage. It is
+  //  in initial when the frame starts, the stages of initial being those the
+  //  frame waits for it in, and left in final afterwards
+  ResourceId importImage(const std::string& name, VkImageAspectFlags aspect, const ResourceUsage& initial, const ResourceUsage& final) {
+    Resource resource;
+    resource.name = name;
+    resource.isImage = true;
+    resource.aspect = aspect;
+    resource.initial = initial;
+    resource.final = final;
+    resource.output = true;
+    return addResource(std::move(resource));
+  }
+
+  // A buffer from outside the graph, bound every frame with bindBuffer. The
+  //  frame's fence keeps earlier frames from using it
+  ResourceId importBuffer(const std::string& name) {
+    Resource resource;
+    resource.name = name;
+    resource.initial = {0, 0, VK_IMAGE_LAYOUT_UNDEFINED, false};
+    return addResource(std::move(resource));
+  }
+
+  // Adds a pass, recorded in the order passes are added. Passes with side
+  //  effects are kept even if nothing reads what they write
+  void addPass(const std::string& name, std::vector<Access> accesses, std::function<void(VkCommandBuffer)> record, bool sideEffects = false) {
+    passes.push_back({name, std::move(accesses), std::move(record), sideEffects, false, {}});
+  }
+
+  // Culls, allocates the transient images and plans the barriers
+  void compile() {
+    cullPasses();
+    createTransients();
+    planBarriers();
+    compiled = true;
+  }
+
+  void bindImage(ResourceId id, VkImage image) {resources[id].image = image;}
+  void bindBuffer(ResourceId id, VkBuffer buffer) {resources[id].buffer = buffer;}
+  VkImageView view(ResourceId id) const {return resources[id].view;}
+
+  // Records every pass that survived culling with the barriers before it,
+  //  building the barrier lists in the frame's arena
+  void execute(VkCommandBuffer commandBuffer, FrameArena& arena) {
+    if (!compiled) {
+      throw std::runtime_error("render graph executed before it was compiled!");
+    }
+    for (const Pass& pass : passes) {
+      if (pass.culled) {continue;}
+      recordBarriers(commandBuffer, pass.barriers, arena);
+      pass.record(commandBuffer);
+    }
+    recordBarriers(commandBuffer, finalBarriers, arena);
+  }
+
+  size_t passCount() const {return passes.size();}
+  size_t culledPassCount() const {return std::count_if(passes.begin(), passes.end(), [](const Pass& pass) {return pass.culled;});}
+  size_t barrierCount() const {
+    size_t count = finalBarriers.size();
+    for (const Pass& pass : passes) {
+      count += pass.barriers.size();
+    }
+    return count;
+  }
+  VkDeviceSize transientBytes() const {return memory.size;} // After aliasing
+  VkDeviceSize unaliasedTransientBytes() const {return unaliasedBytes;}
+
+private:
+  struct Barrier {
+    ResourceId resource;
+    VkPipelineStageFlags srcStages;
+    VkPipelineStageFlags dstStages;
+    VkAccessFlags srcAccess;
+    VkAccessFlags dstAccess;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+  };
+
+  // Where a resource was last written and who read it since
+  struct State {
+    VkPipelineStageFlags writeStages = 0;
+    VkAccessFlags writeAccess = 0;
+    VkPipelineStageFlags readStages = 0; // Read since the write, already waiting for it
+    VkAccessFlags readAccess = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  struct Resource {
+    std::string name;
+    bool isImage = false;
+    bool transient = false;
+    bool output = false; // Used after the graph, keeps its writers alive
+    VkImageAspectFlags aspect = 0;
+    TransientImageDesc desc{};
+    ResourceUsage initial{}; // Imported only
+    ResourceUsage final{VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED, false}; // Imported only, UNDEFINED keeps the last layout
+    VkImage image = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    ImageViewHandle view; // Transient only
+    uint32_t firstPass = ~0u, lastPass = 0; // Lifetime in pass indices, transient only
+    VkDeviceSize memoryOffset = 0, memorySize = 0; // Range in memory, transient only
+    State state; // While planning barriers
+  };
+
+  struct Pass {
+    std::string name;
+    std::vector<Access> accesses;
+    std::function<void(VkCommandBuffer)> record;
+    bool sideEffects;
+    bool culled = false;
+    std::vector<Barrier> barriers; // Recorded before the pass
+  };
+
+  VkDevice device;
+  GpuAllocator* allocator;
+  DeletionQueue* deletionQueue;
+  std::vector<Resource> resources; // Indexed by ResourceId
+  std::vector<Pass> passes; // In recording order
+  std::vector<Barrier> finalBarriers; // Leave imported images in their final layouts
+  GpuAllocation memory; // Backs every transient image
+  VkDeviceSize unaliasedBytes = 0;
+  bool compiled = false;
+
+  ResourceId addResource(Resource&& resource) {
+    resources.push_back(std::move(resource));
+    return static_cast<ResourceId>(resources.size() - 1);
+  }
+
+  // Walks back from the outputs, a pass lives if a living pass or an output
+  //  needs something it writes
+  void cullPasses() {
+    std::vector<bool> needed(resources.size());
+    for (size_t i = 0; i < resources.size(); i++) {
+      needed[i] = resources[i].output;
+    }
+
+    for (auto pass = passes.rbegin(); pass != passes.rend(); ++pass) {
+      bool live = pass->sideEffects;
+      for (const Access& access : pass->accesses) {
+        live = live || (access.usage.writes && needed[access.resource]);
+      }
+      pass->culled = !live;
+      if (!live) {continue;}
+
+      // Whatever it reads must be written by the passes before it
+      for (const Access& access : pass->accesses) {
+        if (!access.discard) {
+          needed[access.resource] = true;
+        }
+      }
+    }
+  }
+
+  // Creates the transient images and places them in one allocation, images
+  //  whose lifetimes don't overlap sharing memory
+  void createTransients() {
+    std::vector<ResourceId> transients;
+    for (uint32_t passIndex = 0; passIndex < passes.size(); passIndex++) {
+      if (passes[passIndex].culled) {continue;}
+      for (const Access& access : passes[passIndex].accesses) {
+        Resource& resource = resources[access.resource];
+        if (!resource.transient) {continue;}
+        if (resource.firstPass == ~0u) {
+          resource.firstPass = passIndex;
+          transients.push_back(access.resource);
+        }
+        resource.lastPass = passIndex;
+      }
+    }
+    if (transients.empty()) {return;}
+
+    VkMemoryRequirements combined{0, 1, ~0u};
+    std::vector<VkMemoryRequirements> requirements(resources.size());
+    for (ResourceId id : transients) {
+      Resource& resource = resources[id];
+      VkImageCreateInfo imageInfo{};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.format = resource.desc.format;
+      imageInfo.extent = {resource.desc.extent.width, resource.desc.extent.height, 1};
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.usage = resource.desc.usage;
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      if (vkCreateImage(device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transient image " + resource.name + "!");
+      }
+
+      vkGetImageMemoryRequirements(device, resource.image, &requirements[id]);
+      resource.memorySize = requirements[id].size;
+      combined.alignment = std::max(combined.alignment, requirements[id].alignment);
+      combined.memoryTypeBits &= requirements[id].memoryTypeBits;
+      unaliasedBytes += requirements[id].size;
+    }
+    if (combined.memoryTypeBits == 0) {
+      throw std::runtime_error("transient images have no memory type in common!");
+    }
+
+    // Largest first, each at the lowest offset clear of the images placed so
+    //  far that are alive at the same time
+    std::sort(transients.begin(), transients.end(), [&](ResourceId a, ResourceId b) {return resources[a].memorySize > resources[b].memorySize;});
+    for (size_t i = 0; i < transients.size(); i++) {
+      Resource& resource = resources[transients[i]];
+      VkDeviceSize offset = 0;
+      bool moved = true;
+      while (moved) {
+        moved = false;
+        for (size_t j = 0; j < i; j++) {
+          const Resource& placed = resources[transients[j]];
+          bool overlapsInTime = placed.firstPass <= resource.lastPass && resource.firstPass <= placed.lastPass;
+          bool overlapsInMemory = placed.memoryOffset < offset + resource.memorySize && offset < placed.memoryOffset + placed.memorySize;
+          if (overlapsInTime && overlapsInMemory) {
+            offset = alignUp(placed.memoryOffset + placed.memorySize, requirements[transients[i]].alignment);
+            moved = true;
+          }
+        }
+      }
+      resource.memoryOffset = offset;
+      combined.size = std::max(combined.size, offset + resource.memorySize);
+    }
+
+    memory = allocator->allocate(combined, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Optimal);
+    for (ResourceId id : transients) {
+      Resource& resource = resources[id];
+      vkBindImageMemory(device, resource.image, memory.memory, memory.offset + resource.memoryOffset);
+
+      VkImageViewCreateInfo viewInfo{};
+      viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image = resource.image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format = resource.desc.format;
+      viewInfo.subresourceRange = {resource.aspect, 0, 1, 0, 1};
+      if (vkCreateImageView(device, &viewInfo, nullptr, resource.view.put(device)) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create transient image view " + resource.name + "!");
+      }
+    }
+  }
+
+  // Plays a frame through twice. Transient images start a frame in the state
+  //  the frame before left them in, which the first run finds out, and the
+  //  second run records the barriers for that steady state
+  void planBarriers() {
+    for (Resource& resource : resources) {
+      resource.state = {};
+    }
+    for (int run = 0; run < 2; run++) {
+      for (Resource& resource : resources) {
+        if (!resource.transient) {
+          resource.state = {resource.initial.stages, resource.initial.access, 0, 0, resource.initial.layout};
+        }
+      }
+
+      std::vector<bool> used(resources.size());
+      for (Pass& pass : passes) {
+        pass.barriers.clear();
+        if (pass.culled) {continue;}
+        for (const Access& access : pass.accesses) {
+          useResource(access.resource, access.usage, access.discard, !used[access.resource], pass.barriers);
+          used[access.resource] = true;
+        }
+      }
+
+      finalBarriers.clear();
+      for (ResourceId id = 0; id < resources.size(); id++) {
+        const Resource& resource = resources[id];
+        if (resource.isImage && !resource.transient && resource.final.layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+          useResource(id, resource.final, false, !used[id], finalBarriers);
+        }
+      }
+    }
+  }
+
+  // Adds the barrier, if any, needed before usage of the resource and updates its state
+  void useResource(ResourceId id, const ResourceUsage& usage, bool discard, bool firstInFrame, std::vector<Barrier>& barriers) {
+    Resource& resource = resources[id];
+    State& state = resource.state;
+
+    // A transient image's first use in a frame waits for everything that
+    //  used its memory before, itself in the last frame included
+    State previous = state;
+    if (resource.transient && firstInFrame) {
+      for (const Resource& other : resources) {
+        if (other.transient && other.image != VK_NULL_HANDLE && other.memoryOffset < resource.memoryOffset + resource.memorySize &&
+            resource.memoryOffset < other.memoryOffset + other.memorySize) {
+          previous.writeStages |= other.state.writeStages;
+          previous.writeAccess |= other.state.writeAccess;
+          previous.readStages |= other.state.readStages;
+        }
+      }
+      if (!discard) {
+        throw std::runtime_error("transient image " + resource.name + " is read before it is written!");
+      }
+    }
+
+    VkImageLayout oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : previous.layout;
+    bool layoutChange = resource.isImage && (usage.layout != previous.layout || (discard && previous.layout != VK_IMAGE_LAYOUT_UNDEFINED));
+    bool hazard;
+    VkPipelineStageFlags srcStages;
+    if (usage.writes || layoutChange) {
+      // Writes and transitions wait for earlier writes and reads alike
+      srcStages = previous.writeStages | previous.readStages;
+      hazard = srcStages != 0;
+    } else {
+      // Reads only wait for the last write, unless an earlier read already did
+      srcStages = previous.writeStages;
+      bool covered = (previous.readStages & usage.stages) == usage.stages && (previous.readAccess & usage.access) == usage.access;
+      hazard = previous.writeStages != 0 && !covered;
+    }
+
+    if (layoutChange || hazard) {
+      barriers.push_back({id, srcStages ? srcStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT), usage.stages,
+          previous.writeAccess, usage.access, oldLayout, resource.isImage ? usage.layout : VK_IMAGE_LAYOUT_UNDEFINED});
+    }
+
+    if (usage.writes) {
+      state = {usage.stages, usage.access, 0, 0, usage.layout};
+    } else if (layoutChange) {
+      // The transition is a write the read now waits for
+      state = {previous.writeStages, previous.writeAccess, usage.stages, usage.access, usage.layout};
+    } else {
+      state.readStages |= usage.stages;
+      state.readAccess |= usage.access;
+    }
+    if (!resource.isImage) {
+      state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+  }
+
+  // Records a pass's barriers as a single vkCmdPipelineBarrier. Buffers are
+  //  covered by one global memory barrier, images each get their own
+  void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers, FrameArena& arena) {
+    if (barriers.empty()) {return;}
+
+    VkPipelineStageFlags srcStages = 0, dstStages = 0;
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    bool bufferBarrier = false;
+    ArenaVector<VkImageMemoryBarrier> imageBarriers{ArenaAllocator<VkImageMemoryBarrier>(arena)};
+    imageBarriers.reserve(barriers.size());
+
+    for (const Barrier& barrier : barriers) {
+      srcStages |= barrier.srcStages;
+      dstStages |= barrier.dstStages;
+      const Resource& resource = resources[barrier.resource];
+      if (!resource.isImage) {
+        memoryBarrier.srcAccessMask |= barrier.srcAccess;
+        memoryBarrier.dstAccessMask |= barrier.dstAccess;
+        bufferBarrier = true;
+        continue;
+      }
+
+      VkImageMemoryBarrier imageBarrier{};
+      imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      imageBarrier.srcAccessMask = barrier.srcAccess;
+      imageBarrier.dstAccessMask = barrier.dstAccess;
+      imageBarrier.oldLayout = barrier.oldLayout;
+      imageBarrier.newLayout = barrier.newLayout;
+      imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.image = resource.image;
+      imageBarrier.subresourceRange = {resource.aspect, 0, 1, 0, 1};
+      imageBarriers.push_back(imageBarrier);
+    }
+
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, bufferBarrier ? 1 : 0, &memoryBarrier,
+        0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+  }
+};
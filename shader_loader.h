@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h> // Necessary for open
+#include <sys/mman.h> // Necessary for mmap
+#include <sys/stat.h> // Necessary for fstat
+#include <unistd.h> // Necessary for close
+
+// First word of every SPIR-V module
+const uint32_t SPIRV_MAGIC = 0x07230203;
+// Magic, version, generator, bound and schema
+const size_t SPIRV_HEADER_WORDS = 5;
+
+// SPIR-V code, either mapped from a file or pointing at words embedded in the
+//  binary. Either way the words are 4 byte aligned and the header is checked
+class SpirvBlob {
+public:
+  SpirvBlob() = default;
+
+  // Maps the file read only, the pages are only read in as Vulkan parses them
+  static SpirvBlob fromFile(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("failed to open shader file " + filename + "!");
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+      close(fd);
+      throw std::runtime_error("failed to stat shader file " + filename + "!");
+    }
+
+    size_t size = static_cast<size_t>(fileStat.st_size);
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    // The mapping keeps the file alive on its own
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      throw std::runtime_error("failed to map shader file " + filename + "!");
+    }
+
+    SpirvBlob blob;
+    blob.code = static_cast<const uint32_t*>(mapped);
+    blob.size = size;
+    blob.mapped = true;
+    blob.validate(filename);
+    return blob;
+  }
+
+  // Wraps code that outlives the blob, such as arrays embedded in the binary
+  static SpirvBlob fromMemory(const uint32_t* code, size_t size, const std::string& name) {
+    SpirvBlob blob;
+    blob.code = code;
+    blob.size = size;
+    blob.validate(name);
+    return blob;
+  }
+
+  ~SpirvBlob() {
+    if (mapped) {
+      munmap(const_cast<uint32_t*>(code), size);
+    }
+  }
+
+  SpirvBlob(SpirvBlob&& other) noexcept
+    : code(std::exchange(other.code, nullptr)), size(std::exchange(other.size, 0)), mapped(std::exchange(other.mapped, false)) {}
+
+  SpirvBlob& operator=(SpirvBlob&& other) noexcept {
+    std::swap(code, other.code);
+    std::swap(size, other.size);
+    std::swap(mapped, other.mapped);
+    return *this;
+  }
+
+  SpirvBlob(const SpirvBlob&) = delete;
+  SpirvBlob& operator=(const SpirvBlob&) = delete;
+
+  const uint32_t* words() const {return code;}
+  size_t wordCount() const {return size / sizeof(uint32_t);}
+  size_t sizeInBytes() const {return size;}
+
+private:
+  const uint32_t* code = nullptr;
+  size_t size = 0; // In bytes
+  bool mapped = false; // Unmapped when destroyed
+
+  // Catches truncated files and files that aren't SPIR-V before the driver sees them
+  void validate(const std::string& name) const {
+    if (size % sizeof(uint32_t) != 0) {
+      throw std::runtime_error("shader " + name + " is not a whole number of SPIR-V words!");
+    }
+    if (size < SPIRV_HEADER_WORDS * sizeof(uint32_t)) {
+      throw std::runtime_error("shader " + name + " is too small for a SPIR-V header!");
+    }
+    if (code[0] != SPIRV_MAGIC) {
+      if (code[0] == __builtin_bswap32(SPIRV_MAGIC)) {
+        throw std::runtime_error("shader " + name + " is SPIR-V of the wrong endianness!");
+      }
+      throw std::runtime_error("shader " + name + " is not SPIR-V!");
+    }
+
+    // Version word is 0 | major | minor | 0. Versions past SPIR-V 1.6 are
+    //  rejected here, ones the driver doesn't consume by vkCreateShaderModule
+    uint32_t major = (code[1] >> 16) & 0xff;
+    uint32_t minor = (code[1] >> 8) & 0xff;
+    if (major != 1 || minor > 6) {
+      throw std::runtime_error("shader " + name + " has unsupported SPIR-V version " +
+          std::to_string(major) + "." + std::to_string(minor) + "!");
+    }
+  }
+};
+
+// Creates every distinct shader module once. Modules are keyed by a hash of
+//  their code, so pipelines sharing a shader, or recreated pipelines, reuse the
+//  module instead of having the driver parse the same SPIR-V again. Locked, as
+//  shader reloads look modules up from the watcher thread
+class ShaderModuleCache {
+public:
+  void init(VkDevice device) {
+    this->device = device;
+  }
+
+  void destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [hash, entries] : modules) {
+      for (const Entry& entry : entries) {
+        vkDestroyShaderModule(device, entry.module, nullptr);
+      }
+    }
+    modules.clear();
+  }
+
+  // Returns the module for the blob's code, creating it on first use
+  VkShaderModule get(const SpirvBlob& blob) {
+    uint64_t key = hash(blob.words(), blob.wordCount());
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Entries sharing a hash are told apart by their code
+    std::vector<Entry>& entries = modules[key];
+    for (const Entry& entry : entries) {
+      if (entry.code.size() == blob.wordCount() &&
+          memcmp(entry.code.data(), blob.words(), blob.sizeInBytes()) == 0) {
+        hits++;
+        return entry.module;
+      }
+    }
+
+    VkShaderModuleCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = blob.sizeInBytes();
+    createInfo.pCode = blob.words();
+
+    Entry entry;
+    if (vkCreateShaderModule(device, &createInfo, nullptr, &entry.module) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create shader module!");
+    }
+    entry.code.assign(blob.words(), blob.words() + blob.wordCount());
+    entries.push_back(std::move(entry));
+    misses++;
+
+    return entries.back().module;
+  }
+
+  // Destroys the module, for shaders whose source changed since. Pipelines
+  //  built from it keep working, they don't need their modules once created,
+  //  but nothing may be building a pipeline from it right now
+  void release(VkShaderModule module) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = modules.begin(); it != modules.end(); ++it) {
+      std::vector<Entry>& entries = it->second;
+      for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].module == module) {
+          vkDestroyShaderModule(device, module, nullptr);
+          entries.erase(entries.begin() + i);
+          if (entries.empty()) {
+            modules.erase(it);
+          }
+          return;
+        }
+      }
+    }
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const auto& [hash, entries] : modules) {
+      count += entries.size();
+    }
+    return count;
+  }
+
+  size_t hitCount() const {return hits;}
+  size_t missCount() const {return misses;}
+
+private:
+  struct Entry {
+    VkShaderModule module;
+    std::vector<uint32_t> code; // Compared on lookup, shaders are small enough to keep around
+  };
+
+  VkDevice device;
+  std::mutex mutex;
+  std::map<uint64_t, std::vector<Entry>> modules;
+  size_t hits = 0;
+  size_t misses = 0;
+
+  // FNV-1a over the words
+  static uint64_t hash(const uint32_t* words, size_t count) {
+    uint64_t value = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; i++) {
+      value ^= words[i];
+      value *= 1099511628211ULL;
+    }
+    return value;
+  }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h> // Necessary for poll
+#include <spawn.h> // Necessary for posix_spawnp
+#include <sys/eventfd.h> // Necessary for eventfd
+#include <sys/inotify.h> // Necessary for inotify
+#include <sys/wait.h> // Necessary for waitpid
+#include <unistd.h> // Necessary for read and close
+
+extern char** environ;
+
+// Editors often save a file in several writes or renames, changes are only
+//  picked up once the directory was quiet for this long
+const int SHADER_WATCH_SETTLE_MS = 100;
+
+// Watches a directory for saved GLSL sources with inotify and recompiles them
+//  with glslc on its own thread. Once all changed sources compiled, onCompiled
+//  is called on that thread with the SPIR-V files that were replaced
+class ShaderWatcher {
+public:
+  struct Shader {
+    std::string source; // File name of the GLSL source inside the directory
+    std::string output; // Path of the SPIR-V file it compiles to
+  };
+
+  ~ShaderWatcher() {stop();}
+
+  void start(const std::string& directory, const std::vector<Shader>& shaders,
+             std::function<void(const std::vector<std::string>&)> onCompiled) {
+    this->directory = directory;
+    this->shaders = shaders;
+    this->onCompiled = std::move(onCompiled);
+
+    inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (inotifyFd < 0) {
+      throw std::runtime_error("failed to initialize inotify!");
+    }
+    // Saving in place closes the file, saving through a temporary renames it over
+    if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      close(inotifyFd);
+      throw std::runtime_error("failed to watch shader directory " + directory + "!");
+    }
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (stopFd < 0) {
+      close(inotifyFd);
+      throw std::runtime_error("failed to create shader watcher event!");
+    }
+
+    thread = std::thread(&ShaderWatcher::watchLoop, this);
+  }
+
+  void stop() {
+    if (!thread.joinable()) {return;}
+
+    uint64_t value = 1;
+    if (write(stopFd, &value, sizeof(value)) != sizeof(value)) {
+      std::cerr << "failed to signal the shader watcher" << std::endl;
+    }
+    thread.join();
+    close(stopFd);
+    close(inotifyFd);
+  }
+
+  // Compiles source into output with glslc. The output is only replaced when
+  //  compilation succeeds, so a shader with errors never reaches the application
+  static bool compile(const std::string& source, const std::string& output) {
+    std::string tempOutput = output + ".tmp";
+    const char* argv[] = {"glslc", source.c_str(), "-o", tempOutput.c_str(), nullptr};
+
+    pid_t pid;
+    if (posix_spawnp(&pid, "glslc", nullptr, nullptr, const_cast<char* const*>(argv), environ) != 0) {
+      std::cerr << "failed to run glslc for " << source << std::endl;
+      return false;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::remove(tempOutput.c_str());
+      return false;
+    }
+    return std::rename(tempOutput.c_str(), output.c_str()) == 0;
+  }
+
+private:
+  std::string directory;
+  std::vector<Shader> shaders;
+  std::function<void(const std::vector<std::string>&)> onCompiled;
+  int inotifyFd = -1;
+  int stopFd = -1; // Written by stop to wake the thread up
+  std::thread thread;
+
+  void watchLoop() {
+    std::set<size_t> changed; // Indices into shaders
+    while (true) {
+      pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+      // Block until something happens, or settle pending changes first
+      int ready = poll(fds, 2, changed.empty() ? -1 : SHADER_WATCH_SETTLE_MS);
+      if (ready < 0) {
+        continue; // Interrupted by a signal
+      }
+      if (fds[1].revents & POLLIN) {
+        return;
+      }
+
+      if (fds[0].revents & POLLIN) {
+        readEvents(changed);
+        continue;
+      }
+
+      // Quiet for long enough, compile everything that changed
+      if (!changed.empty()) {
+        compileChanged(changed);
+        changed.clear();
+      }
+    }
+  }
+
+  void readEvents(std::set<size_t>& changed) {
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length; ) {
+      const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+      if (event->len > 0) {
+        for (size_t i = 0; i < shaders.size(); i++) {
+          if (shaders[i].source == event->name) {
+            changed.insert(i);
+          }
+        }
+      }
+      offset += sizeof(inotify_event) + event->len;
+    }
+  }
+
+  void compileChanged(const std::set<size_t>& changed) {
+    std::vector<std::string> outputs;
+    for (size_t i : changed) {
+      std::string source = directory + "/" + shaders[i].source;
+      std::cout << "recompiling " << source << std::endl;
+      // glslc prints the errors, the old shader stays in use until they are fixed
+      if (!compile(source, shaders[i].output)) {
+        std::cerr << "failed to compile " << source << ", keeping the current pipeline" << std::endl;
+        return;
+      }
+      outputs.push_back(shaders[i].output);
+    }
+
+    try {
+      onCompiled(outputs);
+    } catch (const std::exception& e) {
+      std::cerr << "shader reload failed: " << e.what() << std::endl;
+    }
+  }
+};
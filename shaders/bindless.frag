@@ -0,0 +1,18 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// input colors, texture coordinates and the bindless slot of the texture
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTextureIndex;
+
+// every texture, matches BindlessHeap. The slot is pushed per draw, so it
+// is uniform across a draw and needs no nonuniformEXT
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// returning colors
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(fragColor * texture(textures[fragTextureIndex], fragTexCoord).rgb, 1.0);
+}
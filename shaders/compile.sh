@@ -7,8 +7,14 @@ echo "Script directory: $SCRIPTPATH"
 
 shader_vert_path="${SCRIPTPATH%/}/shader.vert"
 shader_frag_path="${SCRIPTPATH%/}/shader.frag"
+shader_bindless_frag_path="${SCRIPTPATH%/}/bindless.frag"
+shader_cull_path="${SCRIPTPATH%/}/cull.comp"
 shader_vert_out="${SCRIPTPATH%/}/vert.spv"
 shader_frag_out="${SCRIPTPATH%/}/frag.spv"
+shader_bindless_frag_out="${SCRIPTPATH%/}/frag_bindless.spv"
+shader_cull_out="${SCRIPTPATH%/}/cull.spv"
 
 glslc "$shader_vert_path" -o "$shader_vert_out"
 glslc "$shader_frag_path" -o "$shader_frag_out"
+glslc "$shader_bindless_frag_path" -o "$shader_bindless_frag_out"
+glslc "$shader_cull_path" -o "$shader_cull_out"
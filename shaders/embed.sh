@@ -0,0 +1,40 @@
+#!/bin/bash
+# Writes SPIR-V files into a header as constexpr word arrays, so the binary
+#  creates its shader modules without any file I/O.
+#  Words are dumped in host byte order, matching how they are read at runtime
+# Usage: embed.sh OUTPUT.h FILE.spv...
+set -e
+
+output="$1"
+shift
+
+{
+  echo "// Generated by shaders/embed.sh, do not edit"
+  echo "#pragma once"
+  echo ""
+  echo "#include <cstddef>"
+  echo "#include <cstdint>"
+  echo ""
+
+  for file in "$@"; do
+    name="$(basename "$file" .spv)_spv"
+    echo "inline constexpr uint32_t ${name}[] = {"
+    od -An -v -tx4 "$file" | sed -e 's/ *\([0-9a-f]\{8\}\)/0x\1, /g' -e 's/, $/,/' -e 's/^/  /'
+    echo "};"
+    echo ""
+  done
+
+  # Looked up by the path the shader would otherwise be loaded from
+  echo "struct EmbeddedShader {"
+  echo "  const char* path;"
+  echo "  const uint32_t* code;"
+  echo "  size_t size; // In bytes"
+  echo "};"
+  echo ""
+  echo "inline constexpr EmbeddedShader embeddedShaders[] = {"
+  for file in "$@"; do
+    name="$(basename "$file" .spv)_spv"
+    echo "  {\"$file\", ${name}, sizeof(${name})},"
+  done
+  echo "};"
+} > "$output"
@@ -1,12 +1,16 @@
 #version 450
 
-// input colors
+// input colors and texture coordinates
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+// the quads' texture, its mips may still be streaming in
+layout(set = 1, binding = 0) uniform sampler2D texSampler;
 
 // returning colors
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    outColor = vec4(fragColor * texture(texSampler, fragTexCoord).rgb, 1.0);
 }
 
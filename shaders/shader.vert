@@ -1,25 +1,40 @@
 #version 450
 
-// input frag colors
-layout(location = 0) out vec3 fragColor;
+// per frame data, read at the frame's dynamic offset into the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewProjection;
+    float time;
+} frame;
+
+// per draw transform, matches DrawPushConstants
+layout(push_constant) uniform Draw {
+    vec2 offset;
+    float scale;
+    float depth;
+    uint textureIndex;
+} draw;
 
-// positions of different triangle vertices
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// per vertex attributes from the vertex buffer
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
 
-// diffrent colors of each vertex
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// per instance attributes, each from its own stream of the instance buffer
+layout(location = 2) in vec2 instanceOffset;
+layout(location = 3) in float instanceScale;
+layout(location = 4) in vec4 instanceColor;
 
-// Takes positions and fits them into color
+// input frag colors and texture coordinates, and the bindless slot to sample
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
+
+// Scales the quad and moves it to the instance's position, then applies the
+//  draw's transform and depth and the camera, tinting its color and mapping
+//  the texture over the whole quad
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    vec2 position = (inPosition * instanceScale + instanceOffset) * draw.scale + draw.offset;
+    gl_Position = frame.viewProjection * vec4(position, draw.depth, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+    fragTexCoord = inPosition + 0.5;
+    fragTextureIndex = draw.textureIndex;
 }
-
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "deletion_queue.h"
+#include "device_handle.h"
+#include "gpu_memory.h"
+
+// Texel bytes uploaded per frame at most, uploads past it wait for a later
+//  frame. Also the largest level a texture may have, as a level is never split
+const VkDeviceSize TEXTURE_UPLOAD_BUDGET = 4 * 1024 * 1024;
+
+// Filtering and addressing of a sampler, textures sampled the same way share one
+struct SamplerDesc {
+  VkFilter filter = VK_FILTER_LINEAR;
+  VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+  bool operator<(const SamplerDesc& other) const {
+    return std::tie(filter, mipmapMode, addressMode) < std::tie(other.filter, other.mipmapMode, other.addressMode);
+  }
+};
+
+// Creates every distinct sampler once
+class SamplerCache {
+public:
+  void init(VkDevice device) {
+    this->device = device;
+  }
+
+  void destroy() {
+    for (const auto& [desc, sampler] : samplers) {
+      vkDestroySampler(device, sampler, nullptr);
+    }
+    samplers.clear();
+  }
+
+  VkSampler get(const SamplerDesc& desc) {
+    auto found = samplers.find(desc);
+    if (found != samplers.end()) {
+      return found->second;
+    }
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = desc.filter;
+    samplerInfo.minFilter = desc.filter;
+    samplerInfo.mipmapMode = desc.mipmapMode;
+    samplerInfo.addressModeU = desc.addressMode;
+    samplerInfo.addressModeV = desc.addressMode;
+    samplerInfo.addressModeW = desc.addressMode;
+    samplerInfo.anisotropyEnable = VK_FALSE; // Would need the samplerAnisotropy feature
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+
+    VkSampler sampler;
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture sampler!");
+    }
+    samplers.emplace(desc, sampler);
+    return sampler;
+  }
+
+private:
+  VkDevice device;
+  std::map<SamplerDesc, VkSampler> samplers;
+};
+
+// Owns the sampled RGBA8 textures and uploads their texels from a persistently
+//  mapped staging buffer with one region per frame in flight, recording the
+//  copies into the frame's command buffer, TEXTURE_UPLOAD_BUDGET bytes a frame.
+//
+//  Without streaming, level 0 is uploaded and the rest of the mip chain is
+//  blitted from it on the GPU. Streamed textures upload a mip chain built on
+//  the CPU from the smallest level up, one level after the other, and their
+//  view only covers the levels uploaded so far. They are usable after the
+//  first tiny level arrives and sharpen by a level every frame, so many
+//  textures arriving at once never stall a frame on a large upload. Formats
+//  that can't be blitted with linear filtering get the CPU chain as well
+class TextureManager {
+public:
+  using TextureId = uint32_t;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, GpuAllocator& allocator, DeletionQueue& deletionQueue, uint32_t framesInFlight) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->deletionQueue = &deletionQueue;
+    samplers.init(device);
+
+    // Blitting the mip chain needs linear filtering of the format
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, TEXTURE_FORMAT, &formatProperties);
+    VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    blitSupported = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = TEXTURE_UPLOAD_BUDGET * framesInFlight;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture staging buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, stagingBuffer, &memRequirements);
+    stagingAllocation = allocator.allocate(memRequirements,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, GpuResourceKind::Linear);
+    vkBindBufferMemory(device, stagingBuffer, stagingAllocation.memory, stagingAllocation.offset);
+  }
+
+  // Only once the device is idle
+  void destroy() {
+    for (Texture& texture : textures) {
+      texture.view.reset();
+      vkDestroyImage(device, texture.image, nullptr);
+      allocator->free(texture.allocation);
+    }
+    textures.clear();
+    uploads.clear();
+    samplers.destroy();
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->free(stagingAllocation);
+  }
+
+  // Creates a texture from tightly packed RGBA8 texels and queues its upload.
+  //  It can't be sampled before a frame recorded part of the upload
+  TextureId create(uint32_t width, uint32_t height, const uint32_t* texels, bool stream, const SamplerDesc& samplerDesc = {}) {
+    if (VkDeviceSize(width) * height * sizeof(uint32_t) > TEXTURE_UPLOAD_BUDGET) {
+      throw std::runtime_error("texture is larger than the upload budget!");
+    }
+
+    Texture texture;
+    texture.extent = {width, height};
+    texture.mipLevels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2) {
+      texture.mipLevels++;
+    }
+    texture.residentLevel = texture.mipLevels;
+    texture.sampler = samplers.get(samplerDesc);
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = TEXTURE_FORMAT;
+    imageInfo.extent = {width, height, 1};
+    imageInfo.mipLevels = texture.mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    // Levels are blitted from each other when generating mips on the GPU
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, texture.image, &memRequirements);
+    texture.allocation = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Optimal);
+    vkBindImageMemory(device, texture.image, texture.allocation.memory, texture.allocation.offset);
+
+    TextureId id = static_cast<TextureId>(textures.size());
+    textures.push_back(std::move(texture));
+
+    std::vector<uint32_t> level(texels, texels + width * height);
+    if (!stream && blitSupported) {
+      uploads.push_back({id, 0, {width, height}, std::move(level), true, false});
+      return id;
+    }
+
+    // The whole chain comes from the CPU, queued smallest level first
+    std::vector<Upload> chain;
+    VkExtent2D extent = {width, height};
+    for (uint32_t mip = 0; mip < textures[id].mipLevels; mip++) {
+      VkExtent2D nextExtent = {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+      std::vector<uint32_t> next = downsample(level, extent, nextExtent);
+      chain.push_back({id, mip, extent, std::move(level), false, stream});
+      level = std::move(next);
+      extent = nextExtent;
+    }
+    uploads.insert(uploads.end(), std::make_move_iterator(chain.rbegin()), std::make_move_iterator(chain.rend()));
+    return id;
+  }
+
+  // Records this frame's share of the queued uploads into commandBuffer, which
+  //  must be outside of a render pass. The frame's staging region is free, as
+  //  the frame's fence was waited on. Streamed textures that already got a
+  //  level this frame are skipped rather than holding up the uploads queued
+  //  after them, so textures streaming together take as many frames as the
+  //  longest chain
+  void recordUploads(VkCommandBuffer commandBuffer, uint32_t frame) {
+    VkDeviceSize regionStart = frame * TEXTURE_UPLOAD_BUDGET;
+    VkDeviceSize used = 0;
+    lastUploadBytes = 0;
+    if (uploads.empty()) {
+      return;
+    }
+    uploadPass++;
+
+    size_t next = 0;
+    while (next < uploads.size()) {
+      Upload& upload = uploads[next];
+      VkDeviceSize size = upload.texels.size() * sizeof(uint32_t);
+      // Stopping here keeps every texture's levels in order
+      if (used + size > TEXTURE_UPLOAD_BUDGET) {
+        break;
+      }
+      // Streamed textures refine by a single level per frame, their next
+      //  levels are queued after this one and get skipped the same way
+      if (upload.streamed && textures[upload.texture].uploadPass == uploadPass) {
+        next++;
+        continue;
+      }
+
+      VkDeviceSize offset = regionStart + used;
+      memcpy(static_cast<char*>(stagingAllocation.mapped) + offset, upload.texels.data(), size);
+      used += size;
+
+      Texture& texture = textures[upload.texture];
+      transition(commandBuffer, texture.image, upload.level, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+      VkBufferImageCopy region{};
+      region.bufferOffset = offset;
+      region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, upload.level, 0, 1};
+      region.imageExtent = {upload.extent.width, upload.extent.height, 1};
+      vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+      if (upload.generateMips) {
+        generateMips(commandBuffer, texture);
+        texture.residentLevel = 0;
+      } else {
+        transition(commandBuffer, texture.image, upload.level, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        texture.residentLevel = std::min(texture.residentLevel, upload.level);
+      }
+      texture.uploadPass = uploadPass;
+      uploads.erase(uploads.begin() + next);
+    }
+
+    // Widen the views to the levels uploaded this frame
+    for (Texture& texture : textures) {
+      if (texture.uploadPass == uploadPass) {
+        createView(texture);
+      }
+    }
+    lastUploadBytes = used;
+  }
+
+  // Whether any level of the texture can be sampled
+  bool isResident(TextureId id) const {return textures[id].residentLevel < textures[id].mipLevels;}
+  // Whether every level is uploaded
+  bool isComplete(TextureId id) const {return textures[id].residentLevel == 0;}
+  VkImageView view(TextureId id) const {return textures[id].view;}
+  VkSampler sampler(TextureId id) const {return textures[id].sampler;}
+  size_t count() const {return textures.size();}
+  size_t pendingUploads() const {return uploads.size();}
+  VkDeviceSize uploadedBytes() const {return lastUploadBytes;}
+
+private:
+  static constexpr VkFormat TEXTURE_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+  struct Texture {
+    VkImage image;
+    GpuAllocation allocation;
+    VkExtent2D extent;
+    uint32_t mipLevels;
+    uint32_t residentLevel; // Most detailed level uploaded, mipLevels while none is
+    ImageViewHandle view; // Covers residentLevel up to the smallest level
+    VkSampler sampler; // Owned by samplers
+    uint64_t uploadPass = 0; // Last recordUploads call that uploaded one of its levels
+  };
+
+  struct Upload {
+    TextureId texture;
+    uint32_t level;
+    VkExtent2D extent;
+    std::vector<uint32_t> texels;
+    bool generateMips; // Blit the rest of the chain from this level 0
+    bool streamed; // Wait for the next frame if the texture got a level this frame
+  };
+
+  VkDevice device;
+  GpuAllocator* allocator;
+  DeletionQueue* deletionQueue; // Takes views frames in flight may still sample
+  SamplerCache samplers;
+  bool blitSupported = false;
+  VkBuffer stagingBuffer;
+  GpuAllocation stagingAllocation; // One TEXTURE_UPLOAD_BUDGET region per frame in flight
+  std::vector<Texture> textures; // Indexed by TextureId
+  std::deque<Upload> uploads; // In upload order
+  uint64_t uploadPass = 0; // recordUploads calls that had uploads queued
+  VkDeviceSize lastUploadBytes = 0;
+
+  // Blits every level from the one before, leaving all of them shader readable.
+  //  Level 0 starts out as a copy destination
+  void generateMips(VkCommandBuffer commandBuffer, const Texture& texture) {
+    int32_t width = static_cast<int32_t>(texture.extent.width);
+    int32_t height = static_cast<int32_t>(texture.extent.height);
+
+    for (uint32_t level = 1; level < texture.mipLevels; level++) {
+      transition(commandBuffer, texture.image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+      transition(commandBuffer, texture.image, level, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+      int32_t nextWidth = std::max(width / 2, 1);
+      int32_t nextHeight = std::max(height / 2, 1);
+
+      VkImageBlit blit{};
+      blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+      blit.srcOffsets[1] = {width, height, 1};
+      blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+      blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+      vkCmdBlitImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+      transition(commandBuffer, texture.image, level - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+          VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+      width = nextWidth;
+      height = nextHeight;
+    }
+
+    // The smallest level was only ever written
+    transition(commandBuffer, texture.image, texture.mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  }
+
+  // Replaces the texture's view with one covering its resident levels
+  void createView(Texture& texture) {
+    deletionQueue->retire(std::move(texture.view));
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = TEXTURE_FORMAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = texture.residentLevel;
+    viewInfo.subresourceRange.levelCount = texture.mipLevels - texture.residentLevel;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device, &viewInfo, nullptr, texture.view.put(device)) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create texture image view!");
+    }
+  }
+
+  static void transition(VkCommandBuffer commandBuffer, VkImage image, uint32_t level, uint32_t levelCount,
+                         VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                         VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, levelCount, 0, 1};
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+  }
+
+  // 2x2 box filter, clamping at the edges of odd sized levels
+  static std::vector<uint32_t> downsample(const std::vector<uint32_t>& texels, VkExtent2D extent, VkExtent2D nextExtent) {
+    std::vector<uint32_t> next(nextExtent.width * nextExtent.height);
+    for (uint32_t y = 0; y < nextExtent.height; y++) {
+      for (uint32_t x = 0; x < nextExtent.width; x++) {
+        uint32_t x0 = std::min(x * 2, extent.width - 1), x1 = std::min(x * 2 + 1, extent.width - 1);
+        uint32_t y0 = std::min(y * 2, extent.height - 1), y1 = std::min(y * 2 + 1, extent.height - 1);
+        uint32_t samples[4] = {texels[y0 * extent.width + x0], texels[y0 * extent.width + x1],
+                               texels[y1 * extent.width + x0], texels[y1 * extent.width + x1]};
+        uint32_t result = 0;
+        for (uint32_t channel = 0; channel < 32; channel += 8) {
+          uint32_t sum = 0;
+          for (uint32_t sample : samples) {
+            sum += (sample >> channel) & 0xff;
+          }
+          result |= ((sum + 2) / 4) << channel;
+        }
+        next[y * nextExtent.width + x] = result;
+      }
+    }
+    return next;
+  }
+};
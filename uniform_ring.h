@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// Bytes of uniform data each frame in flight can write
+const VkDeviceSize UNIFORM_RING_REGION_SIZE = 64 * 1024;
+
+// Persistently mapped uniform buffer split into one region per frame in
+//  flight. A frame bump allocates its uniform data out of its own region and
+//  hands the offsets to vkCmdBindDescriptorSets as dynamic offsets, so one
+//  descriptor set serves every frame and nothing is mapped or updated per draw.
+//  The region of a frame is only reused once that frame's fence has signaled
+class UniformRing {
+public:
+  struct Allocation {
+    void* data; // Where to write the uniform data
+    uint32_t offset; // Dynamic offset of the data in the buffer
+  };
+
+  // mapped points at one region of regionSize bytes per frame in flight,
+  //  alignment is minUniformBufferOffsetAlignment, which regionSize must be a multiple of
+  void init(void* mapped, VkDeviceSize regionSize, VkDeviceSize alignment) {
+    this->mapped = static_cast<char*>(mapped);
+    this->regionSize = regionSize;
+    this->alignment = alignment;
+    if (regionSize % alignment != 0) {
+      throw std::runtime_error("uniform ring region size is not a multiple of its alignment!");
+    }
+  }
+
+  // Starts allocating from the region of the given frame in flight, dropping
+  //  whatever that frame wrote last time
+  void beginFrame(uint32_t frame) {
+    head = frame * regionSize;
+    end = head + regionSize;
+  }
+
+  Allocation allocate(VkDeviceSize size) {
+    VkDeviceSize offset = (head + alignment - 1) & ~(alignment - 1);
+    if (offset + size > end) {
+      throw std::runtime_error("uniform ring region is full!");
+    }
+    head = offset + size;
+    return {mapped + offset, static_cast<uint32_t>(offset)};
+  }
+
+  // Copies value into the current region and returns its dynamic offset
+  template <typename T>
+  uint32_t push(const T& value) {
+    Allocation allocation = allocate(sizeof(T));
+    memcpy(allocation.data, &value, sizeof(T));
+    return allocation.offset;
+  }
+
+private:
+  char* mapped = nullptr;
+  VkDeviceSize regionSize = 0;
+  VkDeviceSize alignment = 1; // A power of two, as guaranteed for minUniformBufferOffsetAlignment
+  VkDeviceSize head = 0; // Next free byte of the current region
+  VkDeviceSize end = 0; // End of the current region
+};